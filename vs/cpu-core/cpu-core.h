@@ -33,6 +33,9 @@
 #include <algorithm>
 #include <map>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
 #include <functional>
 #include <cmath>
 #include <emmintrin.h>
@@ -123,6 +126,19 @@ using ui64								= unsigned __int64;
 #define CPU_ZERO						1e-20f
 #define CPU_EPSILON						1e-12f
 
+// Thread (pause iterations before a worker or the main thread parks)
+#define CPU_BARRIER_SPIN				4000
+
+// Placement (worker threads on the processor topology)
+#define CPU_PLACEMENT_NONE				0
+#define CPU_PLACEMENT_PIN				1		// one logical processor per worker
+#define CPU_PLACEMENT_SKIP_SMT			2		// one worker per physical core
+#define CPU_PLACEMENT_PERFORMANCE		4		// performance cores only (hybrid processors)
+#define CPU_PLACEMENT_RESERVE_MAIN		8		// main thread pinned alone on the first core, workers pinned on the others
+
+// Blur (larger radii are blurred on a downsampled image)
+#define CPU_BLUR_PYRAMID				8
+
 // Controller
 #define CPU_INPUT_ACTIONS				8
 #define CPU_XINPUT_A					0
@@ -163,6 +179,10 @@ inline XMFLOAT3 CPU_ORANGE				= { 1.0f, 0.5f, 0.0f };
 #include "cpu_vinput.h"
 #include "cpu_input.h"
 #include "cpu_thread.h"
+#include "cpu_barrier.h"
+#include "cpu_topology.h"
+#include "cpu_task.h"
+#include "cpu_scheduler.h"
 #include "cpu_function.h"
 #include "cpu_vec3_cmp.h"
 #include "cpu_vertex.h"
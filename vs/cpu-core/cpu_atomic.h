@@ -7,6 +7,7 @@ public:
 	cpu_atomic() {}
 
 	void operator=(const T& v) { Store(v); }
+	T Load() { return val.load(std::memory_order_relaxed); }
 	void Store(T v) { return val.store(v, std::memory_order_relaxed); }
 	T Add(T v) { return val.fetch_add(v, std::memory_order_relaxed); }
 
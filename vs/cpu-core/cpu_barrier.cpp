@@ -0,0 +1,78 @@
+#include "pch.h"
+
+cpu_barrier::cpu_barrier()
+{
+	m_generation = 0;
+	m_pending = 0;
+	m_quit = false;
+	m_count = 0;
+	m_spin = 0;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_barrier::Create(int count)
+{
+	m_count = count;
+	m_pending = 0;
+	m_quit = false;
+
+	// Single core: spinning only delays the thread that has the work
+	m_spin = std::thread::hardware_concurrency()>1 ? CPU_BARRIER_SPIN : 0;
+}
+
+void cpu_barrier::Quit()
+{
+	m_quit.store(true, std::memory_order_relaxed);
+	Post();
+}
+
+void cpu_barrier::Post()
+{
+	// Published by the generation (release): job pointers and counters set before are visible to the workers
+	m_pending.store(m_count, std::memory_order_relaxed);
+	m_generation.fetch_add(1, std::memory_order_release);
+	m_generation.notify_all();
+}
+
+void cpu_barrier::Wait()
+{
+	// Short jobs: the workers are done before parking is worth it
+	for ( int i=0 ; i<m_spin ; i++ )
+	{
+		if ( m_pending.load(std::memory_order_acquire)==0 )
+			return;
+		_mm_pause();
+	}
+
+	int pending;
+	while ( (pending=m_pending.load(std::memory_order_acquire))!=0 )
+		m_pending.wait(pending, std::memory_order_acquire);
+}
+
+bool cpu_barrier::WaitPost(ui32& generation)
+{
+	// Spin, then park until the generation changes
+	ui32 current = m_generation.load(std::memory_order_acquire);
+	for ( int i=0 ; i<m_spin && current==generation ; i++ )
+	{
+		_mm_pause();
+		current = m_generation.load(std::memory_order_acquire);
+	}
+	while ( current==generation )
+	{
+		m_generation.wait(generation, std::memory_order_acquire);
+		current = m_generation.load(std::memory_order_acquire);
+	}
+
+	generation = current;
+	return m_quit.load(std::memory_order_relaxed)==false;
+}
+
+void cpu_barrier::Arrive()
+{
+	if ( m_pending.fetch_sub(1, std::memory_order_acq_rel)==1 )
+		m_pending.notify_one();
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+// Dispatch without events: the main thread bumps a generation counter, workers spin a little then park on it (futex).
+// Completion is a single counter, the last worker wakes the main thread.
+class cpu_barrier
+{
+public:
+	cpu_barrier();
+
+	void Create(int count);
+	void Quit();
+	ui32 GetGeneration() { return m_generation.load(std::memory_order_acquire); }
+
+	// Main thread
+	void Post();
+	void Wait();
+
+	// Workers
+	bool WaitPost(ui32& generation);
+	void Arrive();
+
+private:
+	std::atomic<ui32> m_generation;
+	std::atomic<int> m_pending;
+	std::atomic<bool> m_quit;
+	int m_count;
+	int m_spin;
+};
@@ -83,6 +83,12 @@ XMFLOAT3 ToColorFromBGR(ui32 bgr)
 	return color;
 }
 
+int ToLuminance(ui32 bgr)
+{
+	// (r + 2g + b) / 4
+	return (((bgr>>16) & 0xFF) + (((bgr>>8) & 0xFF)<<1) + (bgr & 0xFF)) >> 2;
+}
+
 float Lerp(float a, float b, float s)
 {
 	return a + (b-a) * s;
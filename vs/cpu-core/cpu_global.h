@@ -27,6 +27,7 @@ ui32 ToBGR(float r, float g, float b);
 XMFLOAT3 ToColor(int r, int g, int b);
 XMFLOAT3 ToColorFromRGB(ui32 rgb);
 XMFLOAT3 ToColorFromBGR(ui32 bgr);
+int ToLuminance(ui32 bgr);
 
 float Lerp(float a, float b, float s);
 void Lerp(float& out, float a, float b, float t);
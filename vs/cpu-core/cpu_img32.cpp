@@ -3,13 +3,15 @@
 namespace cpu_img32
 {
 
-std::vector<byte>* g_pBlurScratch = nullptr;
-std::vector<int>* g_pBlurDv = nullptr;
+thread_local std::vector<byte> t_blurSmall;
+thread_local std::vector<byte> t_blurScratch;
+thread_local std::vector<int> t_blurSums;
 
 void Free()
 {
-	CPU_DELPTR(g_pBlurScratch);
-	CPU_DELPTR(g_pBlurDv);
+	std::vector<byte>().swap(t_blurSmall);
+	std::vector<byte>().swap(t_blurScratch);
+	std::vector<int>().swap(t_blurSums);
 }
 
 void AlphaBlend(const byte* src, int srcW, int srcH, byte* dst, int dstW, int dstH, int srcX, int srcY, int dstX, int dstY, int blitW, int blitH, XMFLOAT3* pTint)
@@ -570,164 +572,254 @@ bool AlphaBlendStraightOverOpaque(const byte* src, int srcW, int srcH, byte* dst
 // Buffer layout: BGRA, premultiplied, tightly packed => stride = width*4.
 void Blur(byte* img, int width, int height, int radius)
 {
-	if ( img==nullptr || width <= 0 || height <= 0 || radius <= 0 )
-		return;
-	radius = std::min(radius, 254);
+	GaussianBlur(img, width, height, radius);
+}
+
+static inline __m128i LoadPixel(const byte* p)
+{
+	// BGRA -> 4 x int32
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_cvtsi32_si128(*(const int*)p);
+	return _mm_unpacklo_epi16(_mm_unpacklo_epi8(v, zero), zero);
+}
 
+static inline void StorePixel(byte* p, __m128i sum, __m128 scale)
+{
+	// 4 x int32 * scale -> BGRA
+	__m128i v = _mm_cvtps_epi32(_mm_mul_ps(_mm_cvtepi32_ps(sum), scale));
+	v = _mm_packs_epi32(v, v);
+	*(int*)p = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+}
+
+void BoxBlurRows(const byte* src, byte* dst, int width, int height, int radius, int minY, int maxY)
+{
 	const int stride = width * 4;
-	const int div = radius * 2 + 1;
-
-	// Scratch for horizontal pass (same size)
-	if ( g_pBlurScratch==nullptr )
-		g_pBlurScratch = new std::vector<byte>();
-	g_pBlurScratch->resize((size_t)height * (size_t)stride);
-	byte* tmp = g_pBlurScratch->data();
-
-	// Stack entries (B,G,R,A)
-	struct P { int b,g,r,a; };
-	std::vector<P> stack((size_t)div);
-
-	// Precompute division table for this radius (avoids / in the hot loop)
-	const int divSum = ((div + 1) >> 1) * ((div + 1) >> 1);
-	if ( g_pBlurDv==nullptr )
-		g_pBlurDv = new std::vector<int>();
-	if ( divSum!=g_pBlurDv->size() )
+	if ( radius<=0 )
 	{
-		g_pBlurDv->resize((size_t)256 * (size_t)divSum);
-		for (int i = 0; i < 256 * divSum; ++i)
-			(*g_pBlurDv)[i] = i / divSum;
+		if ( src!=dst )
+			memcpy(dst + minY * stride, src + minY * stride, (size_t)(maxY - minY) * stride);
+		return;
 	}
 
-	// -------------------------
-	// Horizontal pass: img -> tmp
-	// -------------------------
-	for (int y = 0; y < height; ++y)
+	const __m128 scale = _mm_set1_ps(1.0f / (float)(radius * 2 + 1));
+	for (int y = minY; y < maxY; ++y)
 	{
-		const byte* srcRow = img + y * stride;
-		byte* dstRow = tmp + y * stride;
-
-		int sumB=0,sumG=0,sumR=0,sumA=0;
-		int inB=0,inG=0,inR=0,inA=0;
-		int outB=0,outG=0,outR=0,outA=0;
+		const byte* s = src + y * stride;
+		byte* d = dst + y * stride;
 
-		// init stack with left edge clamped
+		// Window [-radius, radius], edges clamped
+		__m128i sum = _mm_setzero_si128();
 		for (int i = -radius; i <= radius; ++i)
-		{
-			const int x = cpu::Clamp(i, 0, width - 1);
-			const byte* p = srcRow + x * 4;
-
-			P& s = stack[(size_t)(i + radius)];
-			s.b = p[0]; s.g = p[1]; s.r = p[2]; s.a = p[3];
-
-			const int wgt = radius + 1 - std::abs(i);
-			sumB += s.b * wgt; sumG += s.g * wgt; sumR += s.r * wgt; sumA += s.a * wgt;
-
-			if (i > 0) { inB += s.b; inG += s.g; inR += s.r; inA += s.a; }
-			else       { outB+= s.b; outG+= s.g; outR+= s.r; outA+= s.a; }
-		}
-
-		int stackPtr = radius;
+			sum = _mm_add_epi32(sum, LoadPixel(s + cpu::Clamp(i, 0, width - 1) * 4));
 
 		for (int x = 0; x < width; ++x)
 		{
-			byte* d = dstRow + x * 4;
-			d[0] = (byte)(*g_pBlurDv)[sumB];
-			d[1] = (byte)(*g_pBlurDv)[sumG];
-			d[2] = (byte)(*g_pBlurDv)[sumR];
-			d[3] = (byte)(*g_pBlurDv)[sumA];
-
-			// remove outgoing
-			sumB -= outB; sumG -= outG; sumR -= outR; sumA -= outA;
-
-			int stackStart = stackPtr - radius;
-			if (stackStart < 0) stackStart += div;
-			P& out = stack[(size_t)stackStart];
-
-			outB -= out.b; outG -= out.g; outR -= out.r; outA -= out.a;
-
-			// add incoming (write into outgoing slot)
-			const int xIn = cpu::Clamp(x + radius + 1, 0, width - 1);
-			const byte* pIn = srcRow + xIn * 4;
-
-			out.b = pIn[0]; out.g = pIn[1]; out.r = pIn[2]; out.a = pIn[3];
-
-			inB += out.b; inG += out.g; inR += out.r; inA += out.a;
-			sumB += inB;  sumG += inG;  sumR += inR;  sumA += inA;
-
-			// advance
-			stackPtr = (stackPtr + 1) % div;
-			P& inPix = stack[(size_t)stackPtr];
-
-			outB += inPix.b; outG += inPix.g; outR += inPix.r; outA += inPix.a;
-			inB  -= inPix.b; inG  -= inPix.g; inR  -= inPix.r; inA  -= inPix.a;
+			StorePixel(d + x * 4, sum, scale);
+			const int xIn = std::min(x + radius + 1, width - 1);
+			const int xOut = std::max(x - radius, 0);
+			sum = _mm_add_epi32(sum, _mm_sub_epi32(LoadPixel(s + xIn * 4), LoadPixel(s + xOut * 4)));
 		}
 	}
+}
 
-	// -------------------------
-	// Vertical pass: tmp -> img
-	// -------------------------
-	for (int x = 0; x < width; ++x)
+void BoxBlurCols(const byte* src, byte* dst, int width, int height, int radius, int minX, int maxX, int* sums)
+{
+	const int stride = width * 4;
+	const int count = maxX - minX;
+	if ( radius<=0 )
 	{
-		int sumB=0,sumG=0,sumR=0,sumA=0;
-		int inB=0,inG=0,inR=0,inA=0;
-		int outB=0,outG=0,outR=0,outA=0;
-
-		// init stack with top edge clamped
-		for (int i = -radius; i <= radius; ++i)
+		if ( src!=dst )
 		{
-			const int y = cpu::Clamp(i, 0, height - 1);
-			const byte* p = tmp + y * stride + x * 4;
-
-			P& s = stack[(size_t)(i + radius)];
-			s.b = p[0]; s.g = p[1]; s.r = p[2]; s.a = p[3];
+			for (int y = 0; y < height; ++y)
+				memcpy(dst + y * stride + minX * 4, src + y * stride + minX * 4, (size_t)count * 4);
+		}
+		return;
+	}
 
-			const int wgt = radius + 1 - std::abs(i);
-			sumB += s.b * wgt; sumG += s.g * wgt; sumR += s.r * wgt; sumA += s.a * wgt;
+	// Accumulators: window [-radius, radius] of each column, edges clamped
+	__m128i* acc = (__m128i*)sums;
+	for (int x = 0; x < count; ++x)
+		_mm_storeu_si128(acc + x, _mm_setzero_si128());
+	for (int i = -radius; i <= radius; ++i)
+	{
+		const byte* s = src + cpu::Clamp(i, 0, height - 1) * stride + minX * 4;
+		for (int x = 0; x < count; ++x)
+			_mm_storeu_si128(acc + x, _mm_add_epi32(_mm_loadu_si128(acc + x), LoadPixel(s + x * 4)));
+	}
 
-			if (i > 0) { inB += s.b; inG += s.g; inR += s.r; inA += s.a; }
-			else       { outB+= s.b; outG+= s.g; outR+= s.r; outA+= s.a; }
+	// Rows in memory order: the whole range of columns advances together
+	const __m128 scale = _mm_set1_ps(1.0f / (float)(radius * 2 + 1));
+	for (int y = 0; y < height; ++y)
+	{
+		byte* d = dst + y * stride + minX * 4;
+		const byte* sIn = src + std::min(y + radius + 1, height - 1) * stride + minX * 4;
+		const byte* sOut = src + std::max(y - radius, 0) * stride + minX * 4;
+		for (int x = 0; x < count; ++x)
+		{
+			__m128i sum = _mm_loadu_si128(acc + x);
+			StorePixel(d + x * 4, sum, scale);
+			sum = _mm_add_epi32(sum, _mm_sub_epi32(LoadPixel(sIn + x * 4), LoadPixel(sOut + x * 4)));
+			_mm_storeu_si128(acc + x, sum);
 		}
+	}
+}
 
-		int stackPtr = radius;
+void GaussianBoxes(int radius, int boxes[3])
+{
+	// Box widths whose 3 passes give the variance of sigma = radius/3
+	const float sigma = radius / 3.0f;
+	int wl = (int)floorf(sqrtf(4.0f * sigma * sigma + 1.0f));
+	if ( (wl & 1)==0 )
+		wl--;
+	const int wu = wl + 2;
+	const int m = (int)roundf((12.0f * sigma * sigma - 3.0f * wl * wl - 12.0f * wl - 9.0f) / (-4.0f * wl - 4.0f));
+	int total = 0;
+	for (int i = 0; i < 3; ++i)
+	{
+		boxes[i] = std::max(0, ((i < m ? wl : wu) - 1) / 2);
+		total += boxes[i];
+	}
 
-		for (int y = 0; y < height; ++y)
+	// Support of the 3 passes stays within the radius (halo of the callers)
+	for (int i = 2; total > radius && i >= 0; --i)
+	{
+		while ( boxes[i]>0 && total>radius )
 		{
-			byte* d = img + y * stride + x * 4;
-			d[0] = (byte)(*g_pBlurDv)[sumB];
-			d[1] = (byte)(*g_pBlurDv)[sumG];
-			d[2] = (byte)(*g_pBlurDv)[sumR];
-			d[3] = (byte)(*g_pBlurDv)[sumA];
+			boxes[i]--;
+			total--;
+		}
+	}
+	if ( total==0 && radius>0 )
+		boxes[0] = 1;
+}
 
-			sumB -= outB; sumG -= outG; sumR -= outR; sumA -= outA;
+void GaussianBlurRows(byte* img, byte* tmp, int width, int height, int radius, int minY, int maxY)
+{
+	int boxes[3];
+	GaussianBoxes(radius, boxes);
+	BoxBlurRows(img, tmp, width, height, boxes[0], minY, maxY);
+	BoxBlurRows(tmp, img, width, height, boxes[1], minY, maxY);
+	BoxBlurRows(img, tmp, width, height, boxes[2], minY, maxY);
+}
 
-			int stackStart = stackPtr - radius;
-			if (stackStart < 0) stackStart += div;
-			P& out = stack[(size_t)stackStart];
+void GaussianBlurCols(byte* img, byte* tmp, int width, int height, int radius, int minX, int maxX, int* sums)
+{
+	int boxes[3];
+	GaussianBoxes(radius, boxes);
+	BoxBlurCols(tmp, img, width, height, boxes[0], minX, maxX, sums);
+	BoxBlurCols(img, tmp, width, height, boxes[1], minX, maxX, sums);
+	BoxBlurCols(tmp, img, width, height, boxes[2], minX, maxX, sums);
+}
 
-			outB -= out.b; outG -= out.g; outR -= out.r; outA -= out.a;
+void GaussianBlur(byte* img, int width, int height, int radius)
+{
+	if ( img==nullptr || width<=0 || height<=0 || radius<=0 )
+		return;
 
-			const int yIn = cpu::Clamp(y + radius + 1, 0, height - 1);
-			const byte* pIn = tmp + yIn * stride + x * 4;
+	// Large radius: blur a downsampled copy
+	int factor = GetPyramidFactor(radius);
+	byte* work = img;
+	int w = width;
+	int h = height;
+	if ( factor>1 )
+	{
+		w = (width + factor - 1) / factor;
+		h = (height + factor - 1) / factor;
+		t_blurSmall.resize((size_t)w * h * 4);
+		work = t_blurSmall.data();
+		Downsample(img, width, height, work, factor, 0, h);
+	}
 
-			out.b = pIn[0]; out.g = pIn[1]; out.r = pIn[2]; out.a = pIn[3];
+	// Scratch of the calling thread
+	t_blurScratch.resize((size_t)w * h * 4);
+	t_blurSums.resize((size_t)w * 4);
+	GaussianBlurRows(work, t_blurScratch.data(), w, h, radius / factor, 0, h);
+	GaussianBlurCols(work, t_blurScratch.data(), w, h, radius / factor, 0, w, t_blurSums.data());
 
-			inB += out.b; inG += out.g; inR += out.r; inA += out.a;
-			sumB += inB;  sumG += inG;  sumR += inR;  sumA += inA;
+	if ( factor>1 )
+		Upsample(work, w, h, img, width, height, 0, height);
+}
 
-			stackPtr = (stackPtr + 1) % div;
-			P& inPix = stack[(size_t)stackPtr];
+int GetPyramidFactor(int radius)
+{
+	int factor = 1;
+	while ( radius/factor>CPU_BLUR_PYRAMID )
+		factor *= 2;
+	return factor;
+}
 
-			outB += inPix.b; outG += inPix.g; outR += inPix.r; outA += inPix.a;
-			inB  -= inPix.b; inG  -= inPix.g; inR  -= inPix.r; inA  -= inPix.a;
+void Downsample(const byte* src, int width, int height, byte* dst, int factor, int minY, int maxY)
+{
+	const int dstW = (width + factor - 1) / factor;
+	for (int y = minY; y < maxY; ++y)
+	{
+		const int y0 = y * factor;
+		const int y1 = std::min(y0 + factor, height);
+		for (int x = 0; x < dstW; ++x)
+		{
+			const int x0 = x * factor;
+			const int x1 = std::min(x0 + factor, width);
+			__m128i sum = _mm_setzero_si128();
+			for (int sy = y0; sy < y1; ++sy)
+			{
+				const byte* s = src + (sy * width + x0) * 4;
+				for (int sx = x0; sx < x1; ++sx, s += 4)
+					sum = _mm_add_epi32(sum, LoadPixel(s));
+			}
+			StorePixel(dst + (y * dstW + x) * 4, sum, _mm_set1_ps(1.0f / (float)((x1 - x0) * (y1 - y0))));
+		}
+	}
+}
+
+void Upsample(const byte* src, int srcW, int srcH, byte* dst, int width, int height, int minY, int maxY)
+{
+	// Bilinear, sample centers aligned
+	const float sx = (float)srcW / (float)width;
+	const float sy = (float)srcH / (float)height;
+	for (int y = minY; y < maxY; ++y)
+	{
+		float fy = std::max(0.0f, (y + 0.5f) * sy - 0.5f);
+		int y0 = std::min((int)fy, srcH - 1);
+		int y1 = std::min(y0 + 1, srcH - 1);
+		__m128 ty = _mm_set1_ps(fy - (float)y0);
+		byte* d = dst + y * width * 4;
+		for (int x = 0; x < width; ++x)
+		{
+			float fx = std::max(0.0f, (x + 0.5f) * sx - 0.5f);
+			int x0 = std::min((int)fx, srcW - 1);
+			int x1 = std::min(x0 + 1, srcW - 1);
+			__m128 tx = _mm_set1_ps(fx - (float)x0);
+			__m128 a = _mm_cvtepi32_ps(LoadPixel(src + (y0 * srcW + x0) * 4));
+			__m128 b = _mm_cvtepi32_ps(LoadPixel(src + (y0 * srcW + x1) * 4));
+			__m128 c = _mm_cvtepi32_ps(LoadPixel(src + (y1 * srcW + x0) * 4));
+			__m128 e = _mm_cvtepi32_ps(LoadPixel(src + (y1 * srcW + x1) * 4));
+			__m128 top = _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), tx));
+			__m128 bottom = _mm_add_ps(c, _mm_mul_ps(_mm_sub_ps(e, c), tx));
+			__m128i v = _mm_cvtps_epi32(_mm_add_ps(top, _mm_mul_ps(_mm_sub_ps(bottom, top), ty)));
+			v = _mm_packs_epi32(v, v);
+			*(int*)(d + x * 4) = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
 		}
 	}
 }
 
 void ToAmigaPalette(byte* buffer, int width, int height)
+{
+	ToAmigaPalette(buffer, width, height, 0, 0, width, height);
+}
+
+void ToAmigaPalette(byte* buffer, int width, int height, int rectX, int rectY, int rectW, int rectH)
 {
 	if ( buffer==nullptr || width<=0 || height<=0 )
 		return;
 
+	// Clip
+	if ( rectX<0 ) { rectW += rectX; rectX = 0; }
+	if ( rectY<0 ) { rectH += rectY; rectY = 0; }
+	rectW = std::min(rectW, width - rectX);
+	rectH = std::min(rectH, height - rectY);
+	if ( rectW<=0 || rectH<=0 )
+		return;
+
 	// Dithers prfabriqus pour 4 pixels (16 bytes BGRA BGRA BGRA BGRA)
 	// dd appliqu  B,G,R ; A reste 0.
 	alignas(16) static const unsigned char D_EVENY_XEVEN[16] = {
@@ -754,7 +846,9 @@ void ToAmigaPalette(byte* buffer, int width, int height)
 
 	const int strideBytes = width * 4;
 
-	for (int y = 0; y < height; ++y)
+	const int endX = rectX + rectW;
+	const int endY = rectY + rectH;
+	for (int y = rectY; y < endY; ++y)
 	{
 		unsigned char* row = buffer + y * strideBytes;
 
@@ -763,10 +857,10 @@ void ToAmigaPalette(byte* buffer, int width, int height)
 		const __m128i d_xeven = yOdd ? d_odd_xeven : d_even_xeven;
 		const __m128i d_xodd  = yOdd ? d_odd_xodd  : d_even_xodd;
 
-		int x = 0;
+		int x = rectX;
 
 		// SIMD par blocs de 4 pixels
-		const int simdWidth = width & ~3; // multiple de 4
+		const int simdWidth = rectX + (rectW & ~3); // multiple de 4
 		for (; x < simdWidth; x += 4)
 		{
 			unsigned char* p = row + x * 4;
@@ -803,7 +897,7 @@ void ToAmigaPalette(byte* buffer, int width, int height)
 		}
 
 		// Reste scalaire (0..3 pixels) en fin de ligne
-		for (; x < width; ++x)
+		for (; x < endX; ++x)
 		{
 			unsigned char* q = row + x * 4;
 
@@ -54,6 +54,24 @@ bool AlphaBlendStraightOverOpaque(const byte* src, int srcW, int srcH, byte* dst
 
 void Blur(byte* img, int width, int height, int radius);
 
+// Box blur with running sums (cost independent of the radius), SSE, on a range.
+// BoxBlurCols walks rows with one accumulator per column (sums: 4 ints per column of the range).
+void BoxBlurRows(const byte* src, byte* dst, int width, int height, int radius, int minY, int maxY);
+void BoxBlurCols(const byte* src, byte* dst, int width, int height, int radius, int minX, int maxX, int* sums);
+
+// Gaussian blur (sigma = radius/3) as 3 box passes per axis.
+// Rows: img -> tmp, columns: tmp -> img (tmp has the size of img), ranges are safe to run on several threads.
+void GaussianBoxes(int radius, int boxes[3]);
+void GaussianBlurRows(byte* img, byte* tmp, int width, int height, int radius, int minY, int maxY);
+void GaussianBlurCols(byte* img, byte* tmp, int width, int height, int radius, int minX, int maxX, int* sums);
+void GaussianBlur(byte* img, int width, int height, int radius);
+
+// Pyramid: average of factor x factor blocks, bilinear upsampling (ranges of destination rows)
+int GetPyramidFactor(int radius);
+void Downsample(const byte* src, int width, int height, byte* dst, int factor, int minY, int maxY);
+void Upsample(const byte* src, int srcW, int srcH, byte* dst, int width, int height, int minY, int maxY);
+
 void ToAmigaPalette(byte* buffer, int width, int height);
+void ToAmigaPalette(byte* buffer, int width, int height, int rectX, int rectY, int rectW, int rectH);
 
 }
@@ -15,6 +15,8 @@ void cpu_mesh::Clear()
 	radius = 0.0f;
 	aabb.Zero();
 	obb.Zero();
+	points.clear();
+	edges.clear();
 }
 
 int cpu_mesh::GetTriangleCount()
@@ -92,6 +94,7 @@ void cpu_mesh::Optimize()
 {
 	CalculateNormals();
 	CalculateBoundingVolumes();
+	CalculateEdges();
 }
 
 void cpu_mesh::CalculateNormals()
@@ -126,6 +129,48 @@ void cpu_mesh::CalculateNormals()
 	}
 }
 
+void cpu_mesh::CalculateEdges()
+{
+	// Points
+	points.clear();
+	std::map<XMFLOAT3, int, cpu_vec3_cmp> pointIndices;
+	std::vector<int> indices(vertices.size());
+	for ( size_t i=0 ; i<vertices.size() ; i++ )
+	{
+		auto it = pointIndices.find(vertices[i].pos);
+		if ( it==pointIndices.end() )
+		{
+			it = pointIndices.emplace(vertices[i].pos, (int)points.size()).first;
+			points.push_back(vertices[i].pos);
+		}
+		indices[i] = it->second;
+	}
+
+	// Edges shared by several triangles are kept once
+	std::vector<ui64> keys;
+	keys.reserve(vertices.size());
+	for ( size_t i=0 ; i+2<vertices.size() ; i+=3 )
+	{
+		for ( int e=0 ; e<3 ; e++ )
+		{
+			ui64 a = (ui64)indices[i+e];
+			ui64 b = (ui64)indices[i+(e+1)%3];
+			if ( a==b )
+				continue;
+			keys.push_back(a<b ? (a<<32)|b : (b<<32)|a);
+		}
+	}
+	std::sort(keys.begin(), keys.end());
+	keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+	edges.resize(keys.size()*2);
+	for ( size_t i=0 ; i<keys.size() ; i++ )
+	{
+		edges[i*2] = (int)(keys[i]>>32);
+		edges[i*2+1] = (int)(keys[i] & 0xFFFFFFFF);
+	}
+}
+
 void cpu_mesh::CalculateBoundingVolumes()
 {
 	aabb.min.x = FLT_MAX;
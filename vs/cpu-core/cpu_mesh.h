@@ -8,6 +8,10 @@ public:
 	cpu_aabb aabb;
 	cpu_obb obb;
 
+	// Wireframe: unique positions and unique edges (pairs of point indices)
+	std::vector<XMFLOAT3> points;
+	std::vector<int> edges;
+
 public:
 	cpu_mesh();
 	~cpu_mesh() = default;
@@ -24,6 +28,7 @@ public:
 	void Optimize();
 	void CalculateNormals();
 	void CalculateBoundingVolumes();
+	void CalculateEdges();
 	void XM_CALLCONV Transform(FXMMATRIX matrix);
 
 	void CreatePlane(float width = 1.0f, float height = 1.0f, XMFLOAT3 color = CPU_WHITE);
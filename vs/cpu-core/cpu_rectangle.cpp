@@ -23,3 +23,8 @@ bool cpu_rectangle::IsEmpty()
 		return true;
 	return false;
 }
+
+bool cpu_rectangle::operator==(const cpu_rectangle& other) const
+{
+	return minX==other.minX && maxX==other.maxX && minY==other.minY && maxY==other.maxY;
+}
@@ -14,4 +14,5 @@ public:
 
 	void Zero();
 	bool IsEmpty();
+	bool operator==(const cpu_rectangle& other) const;
 };
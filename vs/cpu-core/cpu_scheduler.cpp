@@ -0,0 +1,219 @@
+#include "pch.h"
+
+cpu_scheduler::cpu_scheduler()
+{
+	m_taskCount = 0;
+	m_remaining = 0;
+	m_spin = 0;
+}
+
+cpu_scheduler::~cpu_scheduler()
+{
+	for ( cpu_task* pTask : m_tasks )
+		delete pTask;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_scheduler::Create(int workerCount)
+{
+	m_queues = std::vector<cpu_queue>(std::max(1, workerCount));
+	m_spin = std::thread::hardware_concurrency()>1 ? CPU_BARRIER_SPIN : 0;
+	Clear();
+}
+
+void cpu_scheduler::Clear()
+{
+	// Tasks are recycled from one graph to the next
+	for ( int i=0 ; i<m_taskCount ; i++ )
+		m_tasks[i]->Reset();
+	m_taskCount = 0;
+	m_remaining = 0;
+}
+
+cpu_task* cpu_scheduler::NewTask()
+{
+	if ( m_taskCount==(int)m_tasks.size() )
+		m_tasks.push_back(new cpu_task);
+	return m_tasks[m_taskCount++];
+}
+
+cpu_task* cpu_scheduler::Add(const std::function<void()>& func)
+{
+	return AddFor(1, 1, [func](int min, int max) { func(); });
+}
+
+cpu_task* cpu_scheduler::AddFor(int count, int grain, const cpu_task::_FUNC& func)
+{
+	cpu_task* pTask = NewTask();
+	pTask->func = func;
+	pTask->count = std::max(0, count);
+	pTask->grain = std::max(1, grain);
+	return pTask;
+}
+
+void cpu_scheduler::Depend(cpu_task* pTask, cpu_task* pBefore)
+{
+	pBefore->next.push_back(pTask);
+	pTask->dependencies.fetch_add(1, std::memory_order_relaxed);
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_scheduler::Start()
+{
+	// Roots are collected first: an empty root finishes at once and schedules its continuations
+	m_remaining.store(m_taskCount, std::memory_order_relaxed);
+	m_roots.clear();
+	for ( int i=0 ; i<m_taskCount ; i++ )
+	{
+		cpu_task* pTask = m_tasks[i];
+		pTask->remaining.store(pTask->count, std::memory_order_relaxed);
+		if ( pTask->dependencies.load(std::memory_order_relaxed)==0 )
+			m_roots.push_back(pTask);
+	}
+
+	// Roots are spread over the workers, the others are pushed by the task they wait for
+	int iWorker = 0;
+	for ( cpu_task* pTask : m_roots )
+	{
+		Schedule(iWorker, pTask);
+		iWorker = (iWorker+1) % (int)m_queues.size();
+	}
+}
+
+void cpu_scheduler::Work(int iWorker)
+{
+	int previous = s_currentWorker;
+	s_currentWorker = iWorker;
+
+	int idle = 0;
+	while ( IsDone()==false )
+		Help(iWorker, idle);
+
+	s_currentWorker = previous;
+}
+
+void cpu_scheduler::Run(int count, int grain, const cpu_task::_FUNC& func)
+{
+	// The graph cannot end meanwhile: the calling task is still running
+	int iWorker = s_currentWorker;
+	cpu_task task;
+	task.func = func;
+	task.count = std::max(0, count);
+	task.grain = std::max(1, grain);
+	task.remaining.store(task.count, std::memory_order_relaxed);
+	m_remaining.fetch_add(1, std::memory_order_relaxed);
+	Schedule(iWorker, &task);
+
+	// No blocking wait: nested ranges cannot deadlock
+	int idle = 0;
+	while ( task.done.load(std::memory_order_acquire)==false )
+		Help(iWorker, idle);
+}
+
+bool cpu_scheduler::Help(int iWorker, int& idle)
+{
+	cpu_chunk chunk;
+	if ( Pop(iWorker, chunk) || Steal(iWorker, chunk) )
+	{
+		Execute(iWorker, chunk);
+		idle = 0;
+		return true;
+	}
+
+	// Nothing to run yet: a task in progress will release more
+	if ( idle++<m_spin )
+		_mm_pause();
+	else
+		std::this_thread::yield();
+	return false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_scheduler::Schedule(int iWorker, cpu_task* pTask)
+{
+	if ( pTask->count==0 )
+		Finish(iWorker, pTask, 0);
+	else
+		Push(iWorker, pTask, 0, pTask->count);
+}
+
+void cpu_scheduler::Push(int iWorker, cpu_task* pTask, int min, int max)
+{
+	cpu_queue& queue = m_queues[iWorker];
+	std::lock_guard<std::mutex> guard(queue.lock);
+	queue.chunks.push_back({ pTask, min, max });
+}
+
+bool cpu_scheduler::Pop(int iWorker, cpu_chunk& chunk)
+{
+	// Newest first: the chunk is still in the cache
+	cpu_queue& queue = m_queues[iWorker];
+	std::lock_guard<std::mutex> guard(queue.lock);
+	if ( queue.chunks.empty() )
+		return false;
+
+	chunk = queue.chunks.back();
+	queue.chunks.pop_back();
+	return true;
+}
+
+bool cpu_scheduler::Steal(int iWorker, cpu_chunk& chunk)
+{
+	// Oldest first: the largest chunks of the victim
+	int count = (int)m_queues.size();
+	for ( int i=1 ; i<count ; i++ )
+	{
+		cpu_queue& queue = m_queues[(iWorker+i) % count];
+		std::lock_guard<std::mutex> guard(queue.lock);
+		if ( queue.chunks.empty() )
+			continue;
+
+		chunk = queue.chunks.front();
+		queue.chunks.pop_front();
+		return true;
+	}
+	return false;
+}
+
+void cpu_scheduler::Execute(int iWorker, cpu_chunk& chunk)
+{
+	// Split down to the grain, the upper halves can be stolen
+	cpu_task* pTask = chunk.pTask;
+	int min = chunk.min;
+	int max = chunk.max;
+	while ( max-min>pTask->grain )
+	{
+		int mid = min + (max-min)/2;
+		Push(iWorker, pTask, mid, max);
+		max = mid;
+	}
+
+	pTask->func(min, max);
+	Finish(iWorker, pTask, max-min);
+}
+
+void cpu_scheduler::Finish(int iWorker, cpu_task* pTask, int count)
+{
+	// Last chunk: the writes of the task are released to its continuations
+	if ( pTask->remaining.fetch_sub(count, std::memory_order_acq_rel)!=count )
+		return;
+
+	for ( cpu_task* pNext : pTask->next )
+	{
+		if ( pNext->dependencies.fetch_sub(1, std::memory_order_acq_rel)==1 )
+			Schedule(iWorker, pNext);
+	}
+
+	// The task can be destroyed once done (nested ranges live on the stack of their caller)
+	pTask->done.store(true, std::memory_order_release);
+	m_remaining.fetch_sub(1, std::memory_order_release);
+}
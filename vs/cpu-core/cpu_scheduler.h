@@ -0,0 +1,62 @@
+#pragma once
+
+// Work stealing: each worker owns a deque of chunks, pops the newest and steals the oldest from the others.
+// A chunk larger than its grain is halved, one half stays stealable. A finished task releases its continuations.
+// Build the graph, Start, then every worker (main thread included) calls Work until the graph is done.
+class cpu_scheduler
+{
+public:
+	cpu_scheduler();
+	virtual ~cpu_scheduler();
+
+	void Create(int workerCount);
+	void Clear();
+	int GetWorkerCount() { return (int)m_queues.size(); }
+
+	// Graph
+	cpu_task* Add(const std::function<void()>& func);
+	cpu_task* AddFor(int count, int grain, const cpu_task::_FUNC& func);
+	void Depend(cpu_task* pTask, cpu_task* pBefore);
+
+	// Run
+	void Start();
+	void Work(int iWorker);
+	bool IsDone() { return m_remaining.load(std::memory_order_acquire)==0; }
+
+	// Nested: from a task, the range joins the running graph and the caller runs chunks until it is done
+	void Run(int count, int grain, const cpu_task::_FUNC& func);
+	static int GetCurrentWorker() { return s_currentWorker; }
+
+private:
+	struct cpu_chunk
+	{
+		cpu_task* pTask;
+		int min;
+		int max;
+	};
+
+	struct cpu_queue
+	{
+		std::mutex lock;
+		std::deque<cpu_chunk> chunks;
+	};
+
+private:
+	cpu_task* NewTask();
+	void Schedule(int iWorker, cpu_task* pTask);
+	void Push(int iWorker, cpu_task* pTask, int min, int max);
+	bool Pop(int iWorker, cpu_chunk& chunk);
+	bool Steal(int iWorker, cpu_chunk& chunk);
+	bool Help(int iWorker, int& idle);
+	void Execute(int iWorker, cpu_chunk& chunk);
+	void Finish(int iWorker, cpu_task* pTask, int count);
+
+private:
+	inline static thread_local int s_currentWorker = -1;
+	std::vector<cpu_task*> m_tasks;
+	int m_taskCount;
+	std::vector<cpu_task*> m_roots;
+	std::vector<cpu_queue> m_queues;
+	std::atomic<int> m_remaining;
+	int m_spin;
+};
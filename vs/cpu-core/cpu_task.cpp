@@ -0,0 +1,21 @@
+#include "pch.h"
+
+cpu_task::cpu_task()
+{
+	Reset();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_task::Reset()
+{
+	func = nullptr;
+	count = 0;
+	grain = 1;
+	dependencies = 0;
+	remaining = 0;
+	done = false;
+	next.clear();
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+// Graph node: a range [0, count) split in chunks of at least grain items, runnable once the tasks it depends on are done
+struct cpu_task
+{
+public:
+	using _FUNC = std::function<void(int min, int max)>;
+
+public:
+	_FUNC func;
+	int count;
+	int grain;
+	std::atomic<int> dependencies;		// unfinished tasks before this one
+	std::atomic<int> remaining;			// unfinished items
+	std::atomic<bool> done;
+	std::vector<cpu_task*> next;		// continuations
+
+public:
+	cpu_task();
+
+	void Reset();
+};
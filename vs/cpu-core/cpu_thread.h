@@ -20,6 +20,7 @@ public:
 	ui32 GetParentID() const { return m_idThreadParent; }
 	ui32 GetID() const { return m_idThread; }
 	bool IsRunning() const { return m_idThread!=0; }
+	HANDLE GetHandle() const { return m_hThread; }
 
 protected:
 	static ui32 WINAPI ThreadProc(void* pParam);
@@ -0,0 +1,171 @@
+#include "pch.h"
+
+cpu_processor::cpu_processor()
+{
+	group = 0;
+	number = 0;
+	core = 0;
+	efficiencyClass = 0;
+	sibling = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+cpu_topology::cpu_topology()
+{
+	coreCount = 0;
+	performanceCoreCount = 0;
+	efficiencyCoreCount = 0;
+	hybrid = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+bool cpu_topology::Detect()
+{
+	processors.clear();
+	coreCount = 0;
+	performanceCoreCount = 0;
+	efficiencyCoreCount = 0;
+	hybrid = false;
+
+	// Cores
+	DWORD size = 0;
+	GetLogicalProcessorInformationEx(RelationProcessorCore, nullptr, &size);
+	std::vector<byte> buffer(size);
+	if ( size==0 || GetLogicalProcessorInformationEx(RelationProcessorCore, (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)buffer.data(), &size)==FALSE )
+	{
+		// Unknown: one core per logical processor
+		int count = std::max(1u, std::thread::hardware_concurrency());
+		for ( int i=0 ; i<count ; i++ )
+		{
+			cpu_processor processor;
+			processor.number = (byte)(i % 64);
+			processor.group = (ui16)(i / 64);
+			processor.core = i;
+			processors.push_back(processor);
+		}
+		coreCount = count;
+		performanceCoreCount = count;
+		return false;
+	}
+
+	byte maxClass = 0;
+	byte minClass = 0xFF;
+	for ( DWORD offset=0 ; offset<size ; )
+	{
+		PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX pInfo = (PSYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX)(buffer.data()+offset);
+		offset += pInfo->Size;
+		if ( pInfo->Relationship!=RelationProcessorCore )
+			continue;
+
+		// Logical processors of the core
+		PROCESSOR_RELATIONSHIP& core = pInfo->Processor;
+		bool first = true;
+		for ( int g=0 ; g<core.GroupCount ; g++ )
+		{
+			GROUP_AFFINITY& affinity = core.GroupMask[g];
+			for ( int bit=0 ; bit<64 ; bit++ )
+			{
+				if ( (affinity.Mask & (1ULL<<bit))==0 )
+					continue;
+
+				cpu_processor processor;
+				processor.group = affinity.Group;
+				processor.number = (byte)bit;
+				processor.core = coreCount;
+				processor.efficiencyClass = core.EfficiencyClass;
+				processor.sibling = first==false;
+				processors.push_back(processor);
+				first = false;
+			}
+		}
+		maxClass = std::max(maxClass, core.EfficiencyClass);
+		minClass = std::min(minClass, core.EfficiencyClass);
+		coreCount++;
+	}
+
+	// Hybrid: the highest class is the performance one
+	hybrid = coreCount>0 && maxClass!=minClass;
+	for ( int i=0 ; i<(int)processors.size() ; i++ )
+	{
+		cpu_processor& processor = processors[i];
+		if ( processor.sibling )
+			continue;
+		if ( processor.efficiencyClass==maxClass )
+			performanceCoreCount++;
+		else
+			efficiencyCoreCount++;
+	}
+	return true;
+}
+
+int cpu_topology::Select(int placement, std::vector<int>& workers)
+{
+	// Candidates: fastest cores first, then the SMT siblings
+	std::vector<int> candidates;
+	byte maxClass = 0;
+	for ( const cpu_processor& processor : processors )
+		maxClass = std::max(maxClass, processor.efficiencyClass);
+	for ( int i=0 ; i<(int)processors.size() ; i++ )
+	{
+		cpu_processor& processor = processors[i];
+		if ( (placement & CPU_PLACEMENT_SKIP_SMT) && processor.sibling )
+			continue;
+		if ( (placement & CPU_PLACEMENT_PERFORMANCE) && hybrid && processor.efficiencyClass!=maxClass )
+			continue;
+		candidates.push_back(i);
+	}
+	std::stable_sort(candidates.begin(), candidates.end(), [this](int a, int b)
+	{
+		cpu_processor& pa = processors[a];
+		cpu_processor& pb = processors[b];
+		if ( pa.efficiencyClass!=pb.efficiencyClass )
+			return pa.efficiencyClass>pb.efficiencyClass;
+		return pa.sibling==false && pb.sibling;
+	});
+
+	// Main thread: alone on the first core (its sibling stays idle)
+	int main = -1;
+	if ( (placement & CPU_PLACEMENT_RESERVE_MAIN) && candidates.size()>1 )
+		main = candidates[0];
+
+	workers.clear();
+	for ( int i : candidates )
+	{
+		if ( main!=-1 && processors[i].core==processors[main].core )
+			continue;
+		workers.push_back(i);
+	}
+	if ( workers.empty() )
+		workers.push_back(candidates.empty() ? 0 : candidates[0]);
+	return main;
+}
+
+bool cpu_topology::Pin(HANDLE hThread, int iProcessor)
+{
+	if ( iProcessor<0 || iProcessor>=(int)processors.size() )
+		return false;
+
+	cpu_processor& processor = processors[iProcessor];
+	GROUP_AFFINITY affinity = {};
+	affinity.Group = processor.group;
+	affinity.Mask = 1ULL << processor.number;
+	return SetThreadGroupAffinity(hThread, &affinity, nullptr)!=FALSE;
+}
+
+bool cpu_topology::Unpin(HANDLE hThread)
+{
+	// Every processor of the current group
+	GROUP_AFFINITY affinity = {};
+	if ( GetThreadGroupAffinity(hThread, &affinity)==FALSE )
+		return false;
+
+	DWORD count = GetActiveProcessorCount(affinity.Group);
+	affinity.Mask = count>=64 ? ~0ULL : (1ULL<<count) - 1;
+	return SetThreadGroupAffinity(hThread, &affinity, nullptr)!=FALSE;
+}
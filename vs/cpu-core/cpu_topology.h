@@ -0,0 +1,33 @@
+#pragma once
+
+struct cpu_processor
+{
+public:
+	ui16 group;
+	byte number;				// in its group
+	int core;
+	byte efficiencyClass;		// higher is faster (hybrid processors)
+	bool sibling;				// second thread of an SMT core
+
+public:
+	cpu_processor();
+};
+
+// Logical processors grouped by physical core, and the worker placement chosen from CPU_PLACEMENT_xxx flags
+struct cpu_topology
+{
+public:
+	std::vector<cpu_processor> processors;
+	int coreCount;
+	int performanceCoreCount;
+	int efficiencyCoreCount;
+	bool hybrid;
+
+public:
+	cpu_topology();
+
+	bool Detect();
+	int Select(int placement, std::vector<int>& workers);
+	bool Pin(HANDLE hThread, int iProcessor);
+	bool Unpin(HANDLE hThread);
+};
@@ -3,7 +3,9 @@
 cpu_transform::cpu_transform()
 {
 	worldUpdated = false;
+	worldChanged = true;
 	invWorldUpdated = false;
+	memset(&world, 0, sizeof(world));
 	Identity();
 }
 
@@ -33,7 +35,9 @@ void cpu_transform::UpdateWorld()
 	w.r[2] = XMVectorMultiply(w.r[2], sz);
 	w.r[3] = XMVectorSetW(p, 1.0f);
 
+	XMFLOAT4X4 old = world;
 	XMStoreFloat4x4(&world, w);
+	worldChanged = memcmp(&old, &world, sizeof(world))!=0;
 	worldUpdated = true;
 	invWorldUpdated = false;
 }
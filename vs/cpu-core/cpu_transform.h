@@ -19,6 +19,7 @@ public:
 private:
 	// World
 	bool worldUpdated;
+	bool worldChanged;
 	XMFLOAT4X4 world;
 	bool invWorldUpdated;
 	XMFLOAT4X4 invWorld;
@@ -30,6 +31,7 @@ public:
 	void UpdateWorld();
 	void UpdateInvWorld();
 	void ResetFlags() { worldUpdated = invWorldUpdated = false; }
+	bool HasChanged() { return worldChanged; }
 	XMFLOAT4X4& GetWorld();
 	XMFLOAT4X4& GetInvWorld();
 	void SetScaling(float scale);
@@ -17,7 +17,7 @@ class cpu_job;
 #define cpuApp							App::GetInstance()
 
 // Macro
-#define CPU_JOBS(j)						{m_nextTile=0;for(size_t i=0;i<(j).size();i++)(j)[i].GetThread()->PostStartEvent(&(j)[i]);for(size_t i=0;i<(j).size();i++)(j)[i].GetThread()->WaitEndEvent();}
+#define CPU_JOBS(j)						{m_nextTile=0;for(size_t i=0;i<(j).size();i++)(j)[i].GetThread()->SetJob(&(j)[i]);m_barrier.Post();m_barrier.Wait();}
 #define CPU_RUN							cpu::Run<cpu_engine, App>
 #define CPU_CALLBACK_START(method)		cpuEngine.GetCallback()->onStart.Set(this, &App::method)
 #define CPU_CALLBACK_UPDATE(method)		cpuEngine.GetCallback()->onUpdate.Set(this, &App::method)
@@ -33,6 +33,47 @@ class cpu_job;
 #define CPU_CLEAR_COLOR					1
 #define CPU_CLEAR_SKY					2
 
+// Resolution
+#define CPU_RESOLUTION_TARGET			(1.0f/60.0f)
+#define CPU_RESOLUTION_MIN				0.5f
+#define CPU_RESOLUTION_STEP				0.125f
+#define CPU_RESOLUTION_HEADROOM			0.85f
+#define CPU_RESOLUTION_SMOOTHING		0.1f
+#define CPU_RESOLUTION_COOLDOWN			30
+
+// Thread (at least one tile each)
+#define CPU_THREAD_MAX					CPU_TILE_MAX
+#define CPU_PLACEMENT_DEFAULT			CPU_PLACEMENT_NONE
+
+// Sweep (frames per configuration, the first ones are skipped)
+#define CPU_SWEEP_FRAMES				120
+#define CPU_SWEEP_WARMUP				20
+
+// Tile
+#define CPU_TILE_ALL					0xFFFFFFFFFFFFFFFFULL
+#define CPU_TILE_MAX					64				// bits of a tile mask
+
+// Bake
+#define CPU_BAKE_AO_RAYS				32
+#define CPU_BAKE_AO_DISTANCE			2.0f
+#define CPU_BAKE_OFFSET					0.001f
+
+// Task (items per chunk before a split stops)
+#define CPU_TASK_PARTICLE_CHUNK			4096			// particles per compaction chunk
+#define CPU_TASK_ENTITY_GRAIN			16
+#define CPU_COUNTER_STRIDE				16				// ints per cache line, one counter per worker
+
+// Post
+#define CPU_POST_CLEAR					0
+#define CPU_POST_BLUR_ROWS				1
+#define CPU_POST_BLUR_COLS				2
+#define CPU_POST_BLEND					3
+#define CPU_POST_AMIGA					4
+#define CPU_POST_AMIGA_TILES			5
+#define CPU_POST_EFFECTS				6
+#define CPU_POST_DOWNSAMPLE				7
+#define CPU_POST_UPSAMPLE				8
+
 // Pass
 #define CPU_PASS_CLEAR_BEGIN			10
 #define CPU_PASS_CLEAR_END				11
@@ -40,6 +81,8 @@ class cpu_job;
 #define CPU_PASS_ENTITY_END				21
 #define CPU_PASS_PARTICLE_BEGIN			30
 #define CPU_PASS_PARTICLE_END			31
+#define CPU_PASS_POST_BEGIN				35
+#define CPU_PASS_POST_END				36
 #define CPU_PASS_UI_BEGIN				40
 #define CPU_PASS_UI_END					41
 #define CPU_PASS_CURSOR_BEGIN			50
@@ -50,8 +93,10 @@ class cpu_job;
 #include "cpu_manager.h"
 #include "cpu_fsm.h"
 #include "cpu_entity.h"
+#include "cpu_entity_snapshot.h"
 #include "cpu_hit.h"
 #include "cpu_stats.h"
+#include "cpu_sweep.h"
 #include "cpu_callback.h"
 #include "cpu_thread_job.h"
 #include "cpu_job.h"
@@ -26,6 +26,59 @@ bool cpu_engine::Create(int width, int height, bool fullscreen, bool amigaStyle)
 	// Options
 	m_renderEnabled = true;
 	m_renderBoxEnabled = false;
+	m_autoShadingRateEnabled = false;
+
+	// Incremental
+	m_incrementalEnabled = false;
+	m_invalidTiles = CPU_TILE_ALL;
+	m_dirtyTiles = CPU_TILE_ALL;
+	m_dirtyTileCount = 0;
+	m_lastLightTiles = 0;
+
+	// Resolution
+	m_dynamicResolutionEnabled = false;
+	m_targetFrameTime = CPU_RESOLUTION_TARGET;
+	m_renderScale = 1.0f;
+	m_workTime = 0.0f;
+	m_resolutionCooldown = 0;
+	m_frameStart.QuadPart = 0;
+	QueryPerformanceFrequency(&m_frameFrequency);
+	m_stats.workTime = 0.0f;
+	m_stats.renderScale = 1.0f;
+
+	// Checkerboard
+	m_checkerboardEnabled = false;
+	m_checkerboardPhase = 0;
+	m_historyValid = false;
+	m_historyIndex = 0;
+
+	// Pipeline
+	m_pipelineEnabled = false;
+	m_framePending = false;
+	m_snapshotCount = 0;
+	m_pLiveLight = nullptr;
+
+	// Particles
+	m_particleSurvivors = 0;
+
+	// Depth prepass
+	m_depthPrepassEnabled = false;
+
+	// Bake
+	m_bakeRequested = false;
+	m_pBakeEntity = nullptr;
+
+	// Shadow
+	m_shadowEnabled = false;
+
+	// Post
+	m_postOp = CPU_POST_CLEAR;
+	m_postRadius = 0;
+	m_postColor = 0;
+	m_pPostRT = nullptr;
+	m_postImage = nullptr;
+	m_postWidth = 0;
+	m_postHeight = 0;
 
 	// Style
 	m_amigaStyle = amigaStyle;
@@ -39,67 +92,35 @@ bool cpu_engine::Create(int width, int height, bool fullscreen, bool amigaStyle)
 
 	// Particles
 	m_particleData.pPhysics = &m_particlePhysics;
+	m_particleSplatCount = 0;
+	m_lastParticleSplatCount = 0;
 
 	// Cursor
 	m_pCursor = nullptr;
+	m_pLastCursor = nullptr;
 
 	// Managers
 	ClearManagers();
 
 	// Cores
-#ifdef CPU_CONFIG_MT
-	m_threadCount = std::max(1u, std::thread::hardware_concurrency());
-#else
-	m_threadCount = 1;
-#endif
-
-	// Tiles
-	m_tileColCount = cpu::CeilToInt(sqrtf((float)m_threadCount));
-	m_tileRowCount = (m_threadCount + m_tileColCount - 1) / m_tileColCount;
-	m_tileCount = m_tileColCount * m_tileRowCount;
-	m_stats.tileCount = m_tileCount;
-	m_tileWidth = width / m_tileColCount;
-	m_tileHeight = height / m_tileRowCount;
-	int missingWidth = width - (m_tileWidth*m_tileColCount);
-	int missingHeight = height - (m_tileHeight*m_tileRowCount);
-	for ( int row=0 ; row<m_tileRowCount ; row++ )
-	{
-		for ( int col=0 ; col<m_tileColCount ; col++ )
-		{
-			cpu_tile tile;
-			tile.row = row;
-			tile.col = col;
-			tile.left = col * m_tileWidth;
-			tile.top = row * m_tileHeight;
-			tile.right = (col+1) * m_tileWidth;
-			tile.bottom = (row+1) * m_tileHeight;
-			if ( row==m_tileRowCount-1 )
-				tile.bottom += missingHeight;
-			if ( col==m_tileColCount-1 )
-				tile.right += missingWidth;
-			tile.particleLocalCounts.resize(m_tileCount);
-			m_tiles.push_back(tile);
-		}
-	}
-
-	// Threads
-	m_stats.threadCount = m_threadCount;
-	m_threads.resize(m_threadCount);
-	for ( int i=0 ; i<m_threadCount ; i++ )
-		m_threads[i].Create(m_tileCount);
-
-	// Jobs
-	m_entityJobs.resize(m_threadCount);
-	m_particlePhysicsJobs.resize(m_threadCount);
-	m_particleSpaceJobs.resize(m_threadCount);
-	m_particleRenderJobs.resize(m_threadCount);
-	for ( int i=0 ; i<m_threadCount ; i++ )
-	{
-		m_entityJobs[i].Create(&m_threads[i]);
-		m_particlePhysicsJobs[i].Create(&m_threads[i]);
-		m_particleSpaceJobs[i].Create(&m_threads[i]);
-		m_particleRenderJobs[i].Create(&m_threads[i]);
-	}
+	m_topology.Detect();
+	m_placement = CPU_PLACEMENT_DEFAULT;
+	m_threadsChanged = false;
+	m_mainProcessor = -1;
+	m_mainPinned = false;
+	m_mainThreadID = GetCurrentThreadId();
+	m_requestedThreadCount = 0;
+	m_requestedTileColCount = 0;
+	m_requestedTileRowCount = 0;
+	CreateThreads(width, height);
+
+	// Sweep
+	m_sweepIndex = -1;
+	m_sweepFrame = 0;
+	m_sweepFrames = CPU_SWEEP_FRAMES;
+	m_sweepThreadCount = 0;
+	m_sweepTileColCount = 0;
+	m_sweepTileRowCount = 0;
 
 	// Callback
 	m_callback.onStart.Set(this, &cpu_engine::OnStart);
@@ -122,8 +143,7 @@ void cpu_engine::Run()
 	m_window.Show();
 
 	// Threads
-	for ( int i=0 ; i<m_threadCount ; i++ )
-		m_threads[i].Run();
+	StartThreads();
 
 	// Reset
 	cpuTime.Reset();
@@ -141,12 +161,16 @@ void cpu_engine::Run()
 			continue;
 
 		// Update
+		QueryPerformanceCounter(&m_frameStart);
 		Update();
 
 		// Render
 		Render();
 	}
 
+	// Pipeline
+	Render_Flush();
+
 	// Cursor
 	SetCursor(nullptr);
 
@@ -158,43 +182,538 @@ void cpu_engine::Run()
 	cpuInput.Reset();
 
 	// Threads
+	StopThreads();
+
+	// Managers
+	Update_Purge();
+	ClearManagers();
+}
+
+void cpu_engine::Quit()
+{
+	m_window.Quit();
+}
+
+void cpu_engine::CreateThreads(int width, int height)
+{
+	// Placement
+	m_mainProcessor = m_topology.Select(m_placement, m_workerProcessors);
+#ifdef CPU_CONFIG_MT
+	m_threadCount = (int)m_workerProcessors.size();
+#else
+	m_threadCount = 1;
+#endif
+	if ( m_requestedThreadCount>0 )
+		m_threadCount = m_requestedThreadCount;
+	m_threadCount = cpu::Clamp(m_threadCount, 1, CPU_THREAD_MAX);
+
+	// More threads than selected processors: they share them
+	int processorCount = (int)m_workerProcessors.size();
+	m_workerProcessors.resize(m_threadCount);
+	for ( int i=processorCount ; i<m_threadCount ; i++ )
+		m_workerProcessors[i] = m_workerProcessors[i % processorCount];
+
+	// Tiles
+	if ( m_requestedTileColCount>0 && m_requestedTileRowCount>0 && m_requestedTileColCount*m_requestedTileRowCount<=CPU_TILE_MAX )
+	{
+		m_tileColCount = m_requestedTileColCount;
+		m_tileRowCount = m_requestedTileRowCount;
+	}
+	else
+	{
+		m_tileColCount = cpu::CeilToInt(sqrtf((float)m_threadCount));
+		m_tileRowCount = (m_threadCount + m_tileColCount - 1) / m_tileColCount;
+	}
+	m_tileCount = m_tileColCount * m_tileRowCount;
+	m_stats.tileCount = m_tileCount;
+	CreateTiles(width, height);
+
+	// Threads
+	m_threads.resize(m_threadCount);
+	m_barrier.Create(m_threadCount);
+	for ( int i=0 ; i<m_threadCount ; i++ )
+		m_threads[i].Create(i, m_tileCount, &m_barrier);
+	m_scheduler.Create(m_threadCount+1);
+
+	// Jobs
+	m_taskJobs.resize(m_threadCount);
+	m_entityJobs.resize(m_threadCount);
+	m_reconstructJobs.resize(m_threadCount);
+	m_bakeJobs.resize(m_threadCount);
+	m_shadowJobs.resize(m_threadCount);
+	m_postJobs.resize(m_threadCount);
+	m_particleRenderJobs.resize(m_threadCount);
+	for ( int i=0 ; i<m_threadCount ; i++ )
+	{
+		m_taskJobs[i].Create(&m_threads[i]);
+		m_entityJobs[i].Create(&m_threads[i]);
+		m_reconstructJobs[i].Create(&m_threads[i]);
+		m_bakeJobs[i].Create(&m_threads[i]);
+		m_shadowJobs[i].Create(&m_threads[i]);
+		m_postJobs[i].Create(&m_threads[i]);
+		m_particleRenderJobs[i].Create(&m_threads[i]);
+	}
+
+	// Stats
+	m_stats.threadCount = m_threadCount;
+	m_stats.coreCount = m_topology.coreCount;
+	m_stats.logicalProcessorCount = (int)m_topology.processors.size();
+	m_stats.performanceCoreCount = m_topology.performanceCoreCount;
+	m_stats.efficiencyCoreCount = m_topology.efficiencyCoreCount;
+	m_stats.placement = m_placement;
+	m_stats.mainProcessor = m_mainProcessor;
+	m_stats.threadProcessors = m_workerProcessors;
+}
+
+void cpu_engine::StartThreads()
+{
+	for ( int i=0 ; i<m_threadCount ; i++ )
+		m_threads[i].Run();
+
+	// Placement
+	if ( m_placement & (CPU_PLACEMENT_PIN|CPU_PLACEMENT_RESERVE_MAIN) )
+	{
+		for ( int i=0 ; i<m_threadCount ; i++ )
+			m_topology.Pin(m_threads[i].GetHandle(), m_workerProcessors[i]);
+	}
+	if ( m_mainProcessor!=-1 )
+		m_mainPinned = m_topology.Pin(GetCurrentThread(), m_mainProcessor);
+	else if ( m_mainPinned )
+		m_mainPinned = m_topology.Unpin(GetCurrentThread())==false;
+}
+
+void cpu_engine::StopThreads()
+{
+	// Threads
+	m_barrier.Quit();
 	for ( int i=0 ; i<m_threadCount ; i++ )
 		m_threads[i].Stop();
 
 	// Jobs
+	m_taskJobs.clear();
 	m_entityJobs.clear();
-	m_particlePhysicsJobs.clear();
-	m_particleSpaceJobs.clear();
+	m_reconstructJobs.clear();
+	m_bakeJobs.clear();
+	m_shadowJobs.clear();
+	m_postJobs.clear();
 	m_particleRenderJobs.clear();
+}
 
-	// Managers
-	Update_Purge();
-	ClearManagers();
+void cpu_engine::CreateTiles(int width, int height)
+{
+	m_tileWidth = width / m_tileColCount;
+	m_tileHeight = height / m_tileRowCount;
+	int missingWidth = width - (m_tileWidth*m_tileColCount);
+	int missingHeight = height - (m_tileHeight*m_tileRowCount);
+	m_tiles.resize(m_tileCount);
+	for ( int row=0 ; row<m_tileRowCount ; row++ )
+	{
+		for ( int col=0 ; col<m_tileColCount ; col++ )
+		{
+			cpu_tile& tile = m_tiles[row*m_tileColCount+col];
+			tile.row = row;
+			tile.col = col;
+			tile.left = col * m_tileWidth;
+			tile.top = row * m_tileHeight;
+			tile.right = (col+1) * m_tileWidth;
+			tile.bottom = (row+1) * m_tileHeight;
+			if ( row==m_tileRowCount-1 )
+				tile.bottom += missingHeight;
+			if ( col==m_tileColCount-1 )
+				tile.right += missingWidth;
+			tile.dirty = true;
+			tile.shadingRate = CPU_SHADING_RATE_1X1;
+			tile.particleLastCount = 0;
+			tile.particleLocalCounts.resize(m_tileCount);
+			tile.particleLocalOffsets.resize(m_tileCount);
+		}
+	}
+}
+
+void cpu_engine::Resize(int width, int height)
+{
+	// Device
+	if ( m_device.Resize(width, height)==false )
+		return;
+	cpu_rt& rt = *m_device.GetMainRT();
+
+	// Tiles
+	CreateTiles(rt.width, rt.height);
+	m_invalidTiles = CPU_TILE_ALL;
+
+	// RTs
+	for ( int i=0 ; i<m_rtManager.count ; i++ )
+	{
+		cpu_rt* pRT = m_rtManager[i];
+		pRT->Create(rt.width, rt.height, pRT->depth, pRT->depthFormat);
+	}
+
+	// Checkerboard
+	if ( m_checkerboardEnabled )
+	{
+		for ( int i=0 ; i<2 ; i++ )
+			m_history[i].Create(rt.width, rt.height, true, rt.depthFormat);
+		m_historyValid = false;
+	}
+
+	// Camera
+	m_camera.aspectRatio = rt.aspectRatio;
+	m_camera.height = m_camera.width / m_camera.aspectRatio;
+	m_camera.UpdateProjection();
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_engine::GetParticleRange(int& min, int& max, int iTile)
+{
+	if ( m_tileCount==1 )
+	{
+		min = 0;
+		max = m_particleData.alive;
+	}
+	else
+	{
+		int count = m_particleData.alive / m_tileCount;
+		int remainder = m_particleData.alive % m_tileCount;
+		min = iTile * count + std::min(iTile, remainder);
+		max = min + count + (iTile<remainder ? 1 : 0);
+	}
+}
+
+void cpu_engine::SetThreadPlacement(int placement)
+{
+	m_placement = placement;
+	m_threadsChanged = true;
+}
+
+void cpu_engine::SetThreadCount(int count)
+{
+	m_requestedThreadCount = std::max(0, count);
+	m_threadsChanged = true;
+}
+
+void cpu_engine::SetTileGrid(int colCount, int rowCount)
+{
+	m_requestedTileColCount = std::max(0, colCount);
+	m_requestedTileRowCount = std::max(0, rowCount);
+	m_threadsChanged = true;
+}
+
+void cpu_engine::AddSweep(int threadCount, int tileColCount, int tileRowCount)
+{
+	if ( IsSweeping() )
+		return;
+
+	cpu_sweep sweep;
+	sweep.threadCount = cpu::Clamp(threadCount, 1, CPU_THREAD_MAX);
+	sweep.tileColCount = std::max(0, tileColCount);
+	sweep.tileRowCount = std::max(0, tileRowCount);
+	m_sweeps.push_back(sweep);
+}
+
+void cpu_engine::StartSweep(int frames)
+{
+	if ( IsSweeping() )
+		return;
+
+	// Default: every thread count
+	if ( m_sweeps.empty() )
+	{
+		int count = std::min((int)m_topology.processors.size(), CPU_THREAD_MAX);
+		for ( int i=1 ; i<=count ; i++ )
+			AddSweep(i);
+	}
+
+	// Previous settings
+	m_sweepThreadCount = m_requestedThreadCount;
+	m_sweepTileColCount = m_requestedTileColCount;
+	m_sweepTileRowCount = m_requestedTileRowCount;
+
+	m_sweepFrames = std::max(1, frames);
+	Sweep_Apply(0);
+}
+
+bool cpu_engine::SaveSweepResults(const char* path)
+{
+	FILE* file = nullptr;
+	if ( fopen_s(&file, path, "wb") || file==nullptr )
+		return false;
+
+	// CSV, one configuration per line (milliseconds)
+	fprintf(file, "threads,cols,rows,frames,avg_ms,min_ms,max_ms\n");
+	for ( const cpu_sweep& sweep : m_sweeps )
+		fprintf(file, "%d,%d,%d,%d,%.3f,%.3f,%.3f\n", sweep.threadCount, sweep.tileColCount, sweep.tileRowCount, sweep.frameCount, sweep.frameTime*1000.0f, sweep.minFrameTime*1000.0f, sweep.maxFrameTime*1000.0f);
+	fclose(file);
+	return true;
+}
+
+void cpu_engine::Sweep_Apply(int index)
+{
+	m_sweepIndex = index;
+	m_sweepFrame = 0;
+	cpu_sweep& sweep = m_sweeps[index];
+	sweep.frameCount = 0;
+	sweep.frameTime = 0.0f;
+	sweep.minFrameTime = 0.0f;
+	sweep.maxFrameTime = 0.0f;
+	SetThreadCount(sweep.threadCount);
+	SetTileGrid(sweep.tileColCount, sweep.tileRowCount);
+}
+
+void cpu_engine::EnableAutoShadingRate(bool enabled)
+{
+	m_autoShadingRateEnabled = enabled;
+	for ( int i=0 ; i<m_tileCount ; i++ )
+		m_tiles[i].shadingRate = CPU_SHADING_RATE_1X1;
+}
+
+void cpu_engine::EnableIncrementalRender(bool enabled)
+{
+	m_incrementalEnabled = enabled;
+	m_invalidTiles = CPU_TILE_ALL;
+}
+
+void cpu_engine::Invalidate()
+{
+	m_invalidTiles = CPU_TILE_ALL;
+}
+
+void cpu_engine::Invalidate(int x, int y, int w, int h)
+{
+	cpu_rectangle box;
+	box.minX = x;
+	box.minY = y;
+	box.maxX = x + w;
+	box.maxY = y + h;
+	m_invalidTiles |= GetTileMask(box);
+}
+
+void cpu_engine::EnableDynamicResolution(bool enabled, float targetFrameTime)
+{
+	m_dynamicResolutionEnabled = enabled;
+	m_targetFrameTime = targetFrameTime;
+	m_workTime = 0.0f;
+	m_resolutionCooldown = 0;
+	if ( enabled==false )
+		SetRenderScale(1.0f);
+}
+
+void cpu_engine::SetRenderScale(float scale)
+{
+	m_renderScale = cpu::Clamp(scale, CPU_RESOLUTION_MIN, 1.0f);
+}
+
+void cpu_engine::EnableCheckerboardRender(bool enabled)
+{
+	if ( enabled==m_checkerboardEnabled )
+		return;
+
+	Render_Flush();
+	m_device.SetCheckerboard(-1);
+
+	m_checkerboardEnabled = enabled;
+	m_historyValid = false;
+	m_invalidTiles = CPU_TILE_ALL;
+	for ( int i=0 ; i<2 ; i++ )
+	{
+		if ( enabled )
+			m_history[i].Create(m_device.GetWidth(), m_device.GetHeight(), true, m_device.GetDepthFormat());
+		else
+			m_history[i].Destroy();
+	}
+}
+
+void cpu_engine::EnablePipeline(bool enabled)
+{
+	m_pipelineEnabled = enabled;
+}
+
+void cpu_engine::EnableDepthPrepass(bool enabled)
+{
+	m_depthPrepassEnabled = enabled;
+	m_invalidTiles = CPU_TILE_ALL;
+}
+
+void cpu_engine::BakeLighting()
+{
+	// Entities are purged and their bounding volumes updated at the next frame
+	m_bakeRequested = true;
+}
+
+void cpu_engine::EnableShadow(bool enabled, int size)
+{
+	Render_Flush();
+	m_shadowEnabled = enabled;
+	m_invalidTiles = CPU_TILE_ALL;
+	if ( enabled==false )
+	{
+		m_shadowMap.Destroy();
+		m_device.SetShadowMap(nullptr);
+		return;
+	}
+
+	m_shadowMap.Create(size, size, true);
+}
+
+void cpu_engine::SetDepthFormat(int format)
+{
+	if ( format==m_device.GetDepthFormat() )
+		return;
+
+	Render_Flush();
+
+	// Main RT and camera projection
+	m_device.SetDepthFormat(format);
+	m_invalidTiles = CPU_TILE_ALL;
+
+	// RTs (same format as the main RT, depth copies stay direct)
+	for ( int i=0 ; i<m_rtManager.count ; i++ )
+	{
+		cpu_rt* pRT = m_rtManager[i];
+		pRT->Create(pRT->width, pRT->height, pRT->depth, format);
+	}
+
+	// Checkerboard
+	if ( m_checkerboardEnabled )
+	{
+		for ( int i=0 ; i<2 ; i++ )
+			m_history[i].Create(m_device.GetWidth(), m_device.GetHeight(), true, format);
+		m_historyValid = false;
+	}
+}
+
+void cpu_engine::GetBand(int iBand, int size, int& min, int& max)
+{
+	min = size * iBand / m_tileCount;
+	max = size * (iBand+1) / m_tileCount;
+}
+
+void cpu_engine::ParallelFor(int begin, int end, int grain, const std::function<void(int min, int max)>& func)
+{
+	int count = end - begin;
+	if ( count<=0 )
+		return;
+
+	// Nested (graph task or a parallel range)
+	if ( cpu_scheduler::GetCurrentWorker()>=0 )
+	{
+		m_scheduler.Run(count, grain, [&](int min, int max) { func(begin+min, begin+max); });
+		return;
+	}
+
+	// Workers busy (pipelined frame, tile jobs) or nothing to split
+	if ( m_framePending || GetCurrentThreadId()!=m_mainThreadID || count<=grain )
+	{
+		func(begin, end);
+		return;
+	}
+
+	// Graph of one task
+	m_scheduler.Clear();
+	m_scheduler.AddFor(count, grain, [&](int min, int max) { func(begin+min, begin+max); });
+	RunTasks();
+}
+
+void cpu_engine::RunTasks()
+{
+	// Workers and main thread share the graph, the last worker index is the main thread
+	m_scheduler.Start();
+	for ( int i=0 ; i<m_threadCount ; i++ )
+		m_threads[i].SetJob(&m_taskJobs[i]);
+	m_barrier.Post();
+	m_scheduler.Work(m_threadCount);
+	m_barrier.Wait();
+}
+
+void cpu_engine::Post(int op)
+{
+	m_postOp = op;
+	CPU_JOBS(m_postJobs);
+}
+
+void cpu_engine::ClearColor()
+{
+	m_postColor = 0;
+	Post(CPU_POST_CLEAR);
+}
+
+void cpu_engine::ClearColor(XMFLOAT3& rgb)
+{
+	m_postColor = cpu::ToBGR(rgb);
+	Post(CPU_POST_CLEAR);
+}
+
+void cpu_engine::Blur(int radius)
+{
+	if ( radius<1 )
+		return;
+
+	// Large radius: blur a downsampled copy
+	cpu_rt& rt = *m_device.GetRT();
+	int factor = cpu_img32::GetPyramidFactor(radius);
+	m_postRadius = radius;
+	m_postImage = (byte*)rt.colorBuffer.data();
+	m_postWidth = rt.width;
+	m_postHeight = rt.height;
+	if ( factor>1 )
+	{
+		m_postWidth = (rt.width + factor - 1) / factor;
+		m_postHeight = (rt.height + factor - 1) / factor;
+		m_postSmall.resize((size_t)m_postWidth * m_postHeight * 4);
+		m_postImage = m_postSmall.data();
+		Post(CPU_POST_DOWNSAMPLE);
+	}
+
+	// Shared scratch (each band writes its own rows or columns)
+	m_postBuffer.resize((size_t)m_postWidth * m_postHeight * 4);
+	m_postRadius = radius / factor;
+	Post(CPU_POST_BLUR_ROWS);
+	Post(CPU_POST_BLUR_COLS);
+	if ( factor>1 )
+		Post(CPU_POST_UPSAMPLE);
+	m_postImage = nullptr;
 }
 
-void cpu_engine::Quit()
+void cpu_engine::AlphaBlend(cpu_rt* pRT)
 {
-	m_window.Quit();
+	if ( pRT==nullptr )
+		return;
+
+	m_pPostRT = pRT;
+	Post(CPU_POST_BLEND);
+	m_pPostRT = nullptr;
 }
 
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+void cpu_engine::ToAmigaStyle()
+{
+	Post(CPU_POST_AMIGA);
+}
 
-void cpu_engine::GetParticleRange(int& min, int& max, int iTile)
+ui64 cpu_engine::GetTileMask(cpu_rectangle& box)
 {
-	if ( m_tileCount==1 )
-	{
-		min = 0;
-		max = m_particleData.alive;
-	}
-	else
+	cpu_rt& rt = *m_device.GetMainRT();
+	if ( box.IsEmpty() || box.maxX<=0 || box.maxY<=0 || box.minX>=rt.width || box.minY>=rt.height )
+		return 0;
+
+	int minX = cpu::Clamp(box.minX/m_tileWidth, 0, m_tileColCount-1);
+	int maxX = cpu::Clamp((box.maxX-1)/m_tileWidth, 0, m_tileColCount-1);
+	int minY = cpu::Clamp(box.minY/m_tileHeight, 0, m_tileRowCount-1);
+	int maxY = cpu::Clamp((box.maxY-1)/m_tileHeight, 0, m_tileRowCount-1);
+
+	ui64 mask = 0;
+	int offset = minY * m_tileColCount;
+	for ( int y=minY ; y<=maxY ; y++ )
 	{
-		int count = m_particleData.alive / m_tileCount;
-		int remainder = m_particleData.alive % m_tileCount;
-		min = iTile * count + std::min(iTile, remainder);
-		max = min + count + (iTile<remainder ? 1 : 0);
+		for ( int x=minX ; x<=maxX ; x++ )
+		{
+			int index = offset + x;
+			mask |= 1ULL << index;
+		}
+		offset += m_tileColCount;
 	}
+	return mask;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -221,10 +740,17 @@ cpu_particle_emitter* cpu_engine::CreateParticleEmitter()
 cpu_rt* cpu_engine::CreateRT(bool depth)
 {
 	cpu_rt* pRT = m_rtManager.Create();
-	pRT->Create(m_device.GetWidth(), m_device.GetHeight(), depth);
+	pRT->Create(m_device.GetWidth(), m_device.GetHeight(), depth, m_device.GetDepthFormat());
 	return pRT;
 }
 
+cpu_light* cpu_engine::CreateLight(int type)
+{
+	cpu_light* pLight = m_lightManager.Create();
+	pLight->type = (byte)type;
+	return pLight;
+}
+
 cpu_player* cpu_engine::CreatePlayer()
 {
 	return m_playerManager.Create();
@@ -238,16 +764,22 @@ void cpu_engine::ClearManagers()
 	m_fsmManager.Clear();
 	m_rtManager.Clear();
 	m_playerManager.Clear();
+	m_lightManager.Clear();
+	m_invalidTiles = CPU_TILE_ALL;
 }
 
 cpu_entity* cpu_engine::Release(cpu_entity* pEntity)
 {
+	if ( pEntity )
+		m_invalidTiles |= pEntity->lastTile;
 	m_entityManager.Release(pEntity);
 	return nullptr;
 }
 
 cpu_sprite* cpu_engine::Release(cpu_sprite* pSprite)
 {
+	if ( pSprite )
+		m_invalidTiles |= GetTileMask(pSprite->lastBox);
 	m_spriteManager.Release(pSprite);
 	return nullptr;
 }
@@ -270,6 +802,12 @@ cpu_player* cpu_engine::Release(cpu_player* pPlayer)
 	return nullptr;
 }
 
+cpu_light* cpu_engine::Release(cpu_light* pLight)
+{
+	m_lightManager.Release(pLight);
+	return nullptr;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -471,6 +1009,9 @@ void cpu_engine::Update()
 	// Callback
 	m_callback.onUpdate.Call();
 
+	// Pipeline: the update overlaps the previous frame, which is done before the purge
+	Render_Flush();
+
 	// Purge
 	Update_Purge();
 }
@@ -522,14 +1063,10 @@ void cpu_engine::Update_Particles()
 		if ( pEmitter->dead )
 			continue;
 
-		pEmitter->Update(m_device.GetPixelCount());
+		pEmitter->Update(m_device.GetFullWidth()*m_device.GetFullHeight());
 	}
 
-	// Particles: age
-	m_particleData.UpdateAge();
-
-	// Particles: tiles (MT)
-	CPU_JOBS(m_particlePhysicsJobs);
+	// Particles: physics, age and compaction run in the frame graph, beside the entity culling
 }
 
 void cpu_engine::Update_Audio()
@@ -552,6 +1089,7 @@ void cpu_engine::Update_Purge()
 	m_spriteManager.Purge();
 	m_rtManager.Purge();
 	m_playerManager.Purge();
+	m_lightManager.Purge();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -560,130 +1098,729 @@ void cpu_engine::Update_Purge()
 
 void cpu_engine::Render()
 {
+	// Threads
+	Render_Threads();
+
+	// Resolution
+	Render_Resolution();
+
 	// Camera
 	m_device.UpdateCamera();
 
-	// Rendering disabled
-	if ( m_renderEnabled==false )
-		return;
-
 	// Tiles
 	for ( int i=0 ; i<m_tileCount ; i++ )
 		m_tiles[i].Reset();
 
-	// Prepare
-	Render_SortZ();
-	Render_RecalculateMatrices();
-	Render_ApplyClipping();
-	Render_AssignEntityTile();
+	// Prepare (particles still move when rendering is disabled)
+	Render_Prepare();
+	if ( m_renderEnabled==false )
+		return;
 
-	// Clear
+	Render_Bake();
+	Render_Invalidate();
+	Render_Shadow();
+
+	// Clear (done by each tile job, just before its entities)
 	m_callback.onRender.Call(CPU_PASS_CLEAR_BEGIN);
-	m_device.ClearDepth();
-	switch ( m_clear )
-	{
-	case CPU_CLEAR_COLOR:
-		m_device.ClearColor(m_clearColor);
-		break;
-	case CPU_CLEAR_SKY:
-		m_device.ClearSky(m_groundColor, m_skyColor);
-		break;
-	}
 	m_callback.onRender.Call(CPU_PASS_CLEAR_END);
 
-	// Entities
+	// Entities (pipeline: the next update runs during the rasterization)
 	m_callback.onRender.Call(CPU_PASS_ENTITY_BEGIN);
 	Render_Entities();
+	if ( m_framePending )
+		return;
+
+	Render_Finish();
+}
+
+void cpu_engine::Render_Finish()
+{
+	// Entities
+	Render_Wait();
+	Render_Reconstruct();
 	m_callback.onRender.Call(CPU_PASS_ENTITY_END);
 
 	// Particles
-	m_callback.onRender.Call(CPU_PASS_PARTICLE_BEGIN);
-	Render_Particles();
-	m_callback.onRender.Call(CPU_PASS_PARTICLE_END);
-
-	// Stats
-	m_stats.drawnTriangleCount = 0;
+	m_callback.onRender.Call(CPU_PASS_PARTICLE_BEGIN);
+	Render_Particles();
+	m_callback.onRender.Call(CPU_PASS_PARTICLE_END);
+
+	// Effects
+	m_callback.onRender.Call(CPU_PASS_POST_BEGIN);
+	Render_Effects();
+	m_callback.onRender.Call(CPU_PASS_POST_END);
+
+	// Stats
+	m_stats.drawnTriangleCount = 0;
+	for ( int i=0 ; i<m_tileCount ; i++ )
+		m_stats.drawnTriangleCount += m_tiles[i].statsDrawnTriangleCount;
+	m_stats.dirtyTileCount = m_dirtyTileCount;
+
+	// UI
+	m_callback.onRender.Call(CPU_PASS_UI_BEGIN);
+	Render_UI();
+	m_callback.onRender.Call(CPU_PASS_UI_END);
+
+	// Cursor
+	m_callback.onRender.Call(CPU_PASS_CURSOR_BEGIN);
+	Render_Cursor();
+	m_callback.onRender.Call(CPU_PASS_CURSOR_END);
+
+	// Style
+	Render_Style();
+
+	// Work time
+	LARGE_INTEGER now;
+	QueryPerformanceCounter(&now);
+	float workTime = float(now.QuadPart-m_frameStart.QuadPart) / float(m_frameFrequency.QuadPart);
+	m_workTime = m_workTime>0.0f ? m_workTime + (workTime-m_workTime)*CPU_RESOLUTION_SMOOTHING : workTime;
+	m_stats.workTime = m_workTime;
+	Render_Sweep(workTime);
+
+	// Present
+	m_device.Present();
+}
+
+void cpu_engine::Render_Threads()
+{
+	if ( m_threadsChanged==false )
+		return;
+
+	// Between two frames (a pipelined frame is done during the update)
+	m_threadsChanged = false;
+	StopThreads();
+	cpu_rt& rt = *m_device.GetMainRT();
+	CreateThreads(rt.width, rt.height);
+	StartThreads();
+	m_invalidTiles = CPU_TILE_ALL;
+}
+
+void cpu_engine::Render_Sweep(float workTime)
+{
+	if ( m_sweepIndex==-1 )
+		return;
+
+	// Warmup (caches, shading rate, dynamic resolution)
+	if ( m_sweepFrame++<CPU_SWEEP_WARMUP )
+		return;
+
+	cpu_sweep& sweep = m_sweeps[m_sweepIndex];
+	sweep.tileColCount = m_tileColCount;
+	sweep.tileRowCount = m_tileRowCount;
+	sweep.minFrameTime = sweep.frameCount ? std::min(sweep.minFrameTime, workTime) : workTime;
+	sweep.maxFrameTime = std::max(sweep.maxFrameTime, workTime);
+	sweep.frameTime += (workTime-sweep.frameTime) / float(++sweep.frameCount);
+	if ( sweep.frameCount<m_sweepFrames )
+		return;
+
+	// Next configuration
+	if ( m_sweepIndex+1<(int)m_sweeps.size() )
+	{
+		Sweep_Apply(m_sweepIndex+1);
+		return;
+	}
+
+	// Done
+	m_sweepIndex = -1;
+	SetThreadCount(m_sweepThreadCount);
+	SetTileGrid(m_sweepTileColCount, m_sweepTileRowCount);
+}
+
+void cpu_engine::Render_Resolution()
+{
+	// Budget
+	if ( m_dynamicResolutionEnabled && m_workTime>0.0f )
+	{
+		if ( m_resolutionCooldown>0 )
+			m_resolutionCooldown--;
+		else if ( m_workTime>m_targetFrameTime && m_renderScale>CPU_RESOLUTION_MIN )
+			SetRenderScale(m_renderScale-CPU_RESOLUTION_STEP);
+		else if ( m_renderScale<1.0f )
+		{
+			// Cost grows with the pixel count
+			float up = std::min(1.0f, m_renderScale+CPU_RESOLUTION_STEP);
+			float ratio = up / m_renderScale;
+			if ( m_workTime*ratio*ratio<m_targetFrameTime*CPU_RESOLUTION_HEADROOM )
+				SetRenderScale(up);
+		}
+	}
+
+	// Size
+	int width = cpu::RoundToInt(m_device.GetFullWidth() * m_renderScale);
+	int height = cpu::RoundToInt(m_device.GetFullHeight() * m_renderScale);
+	if ( width==m_device.GetWidth() && height==m_device.GetHeight() )
+		return;
+
+	Resize(width, height);
+	m_resolutionCooldown = CPU_RESOLUTION_COOLDOWN;
+	m_stats.renderScale = m_renderScale;
+}
+
+void cpu_engine::Render_Prepare()
+{
+	// Graph: the particle chain overlaps the entity chain
+	m_scheduler.Clear();
+	cpu_task* pSwap = Render_CompactParticles();
+	if ( m_renderEnabled==false )
+	{
+		RunTasks();
+		return;
+	}
+
+	// Particles
+	cpu_task* pSpace = m_scheduler.AddFor(m_tileCount, 1, [this](int min, int max) { for ( int i=min ; i<max ; i++ ) Render_AssignParticleTile(i); });
+	cpu_task* pBin = m_scheduler.Add([this]() { Render_BinParticles(); });
+	cpu_task* pScatter = m_scheduler.AddFor(m_tileCount, 1, [this](int min, int max) { for ( int i=min ; i<max ; i++ ) Render_ScatterParticles(i); });
+	m_scheduler.Depend(pSpace, pSwap);
+	m_scheduler.Depend(pBin, pSpace);
+	m_scheduler.Depend(pScatter, pBin);
+
+	// Entities: one pass per range, then the sort (view depth of this frame) beside the lights
+	cpu_task* pEntities = m_scheduler.AddFor(m_entityManager.count, CPU_TASK_ENTITY_GRAIN, [this](int min, int max) { Render_PrepareEntities(min, max); });
+	cpu_task* pSort = m_scheduler.Add([this]() { Render_SortZ(); });
+	cpu_task* pLight = m_scheduler.Add([this]() { Render_AssignLightTile(); });
+	m_scheduler.Depend(pSort, pEntities);
+	m_scheduler.Depend(pLight, pEntities);
+
+	m_clipCounts.assign(m_scheduler.GetWorkerCount()*CPU_COUNTER_STRIDE, 0);
+	RunTasks();
+	m_stats.clipEntityCount = 0;
+	for ( size_t i=0 ; i<m_clipCounts.size() ; i+=CPU_COUNTER_STRIDE )
+		m_stats.clipEntityCount += m_clipCounts[i];
+}
+
+cpu_task* cpu_engine::Render_CompactParticles()
+{
+	// Chunks: physics and age, then the survivors are scattered in order into the other buffer
+	int chunkCount = (m_particleData.alive + CPU_TASK_PARTICLE_CHUNK - 1) / CPU_TASK_PARTICLE_CHUNK;
+	m_particleChunks.resize(chunkCount+1);
+	m_particleSurvivors = m_particleData.alive;
+
+	// Age
+	cpu_task* pAge = m_scheduler.AddFor(chunkCount, 1, [this](int min, int max)
+	{
+		for ( int c=min ; c<max ; c++ )
+		{
+			int first = c * CPU_TASK_PARTICLE_CHUNK;
+			int last = std::min(first+CPU_TASK_PARTICLE_CHUNK, m_particleData.alive);
+			m_particleData.UpdatePhysics(first, last);
+			m_particleChunks[c] = m_particleData.UpdateAge(first, last);
+		}
+	});
+
+	// Offsets (exclusive prefix sum)
+	cpu_task* pOffsets = m_scheduler.Add([this, chunkCount]()
+	{
+		int offset = 0;
+		for ( int c=0 ; c<chunkCount ; c++ )
+		{
+			int count = m_particleChunks[c];
+			m_particleChunks[c] = offset;
+			offset += count;
+		}
+		m_particleChunks[chunkCount] = offset;
+		m_particleSurvivors = offset;
+	});
+
+	// Scatter (nothing died: the buffer stays)
+	cpu_task* pScatter = m_scheduler.AddFor(chunkCount, 1, [this](int min, int max)
+	{
+		if ( m_particleSurvivors==m_particleData.alive )
+			return;
+		for ( int c=min ; c<max ; c++ )
+		{
+			int first = c * CPU_TASK_PARTICLE_CHUNK;
+			int last = std::min(first+CPU_TASK_PARTICLE_CHUNK, m_particleData.alive);
+			m_particleData.Scatter(first, last, m_particleChunks[c]);
+		}
+	});
+
+	// Swap
+	cpu_task* pSwap = m_scheduler.Add([this]()
+	{
+		if ( m_particleSurvivors!=m_particleData.alive )
+			m_particleData.Swap(m_particleSurvivors);
+	});
+
+	m_scheduler.Depend(pOffsets, pAge);
+	m_scheduler.Depend(pScatter, pOffsets);
+	m_scheduler.Depend(pSwap, pScatter);
+	return pSwap;
+}
+
+void cpu_engine::Render_SortZ()
+{
+	// Entities
+	std::sort(m_entityManager.sortedList.begin(), m_entityManager.sortedList.begin()+m_entityManager.count, [](const cpu_entity* pA, const cpu_entity* pB) { return pA->view.z < pB->view.z; });
+	for ( int i=0 ; i<m_entityManager.count ; i++ )
+		m_entityManager.sortedList[i]->sortedIndex = i;
+
+	// Sprites
+	std::sort(m_spriteManager.sortedList.begin(), m_spriteManager.sortedList.begin()+m_spriteManager.count, [](const cpu_sprite* pA, const cpu_sprite* pB) { return pA->z < pB->z; });
+	for ( int i=0 ; i<m_spriteManager.count ; i++ )
+		m_spriteManager.sortedList[i]->sortedIndex = i;
+}
+
+void cpu_engine::Render_PrepareEntities(int min, int max)
+{
+	// Matrices, clipping and tiles while the entity is in the cache
+	cpu_rt& rt = *m_device.GetRT();
+	int clipCount = 0;
+	for ( int i=min ; i<max ; i++ )
+	{
+		cpu_entity* pEntity = m_entityManager[i];
+		pEntity->UpdateWorld(&m_camera, rt.width, rt.height);
+		pEntity->Clip(&m_camera, &clipCount);
+		pEntity->tile = pEntity->dead || pEntity->clipped ? 0 : GetTileMask(pEntity->box);
+
+		// Inverse (normals): computed once here, the tile jobs only read it
+		if ( pEntity->tile )
+			pEntity->transform.GetInvWorld();
+	}
+
+	// Counter of the worker (own cache line)
+	m_clipCounts[cpu_scheduler::GetCurrentWorker()*CPU_COUNTER_STRIDE] += clipCount;
+}
+
+void cpu_engine::Render_Bake()
+{
+	if ( m_bakeRequested==false )
+		return;
+	m_bakeRequested = false;
+
+	// Occlusion rays: fixed directions on the sphere (golden angle spiral), flipped in the normal hemisphere
+	m_bakeRays.resize(CPU_BAKE_AO_RAYS);
+	for ( int i=0 ; i<CPU_BAKE_AO_RAYS ; i++ )
+	{
+		float y = 1.0f - (i + 0.5f) * 2.0f / CPU_BAKE_AO_RAYS;
+		float r = sqrtf(std::max(0.0f, 1.0f - y*y));
+		float a = i * 2.39996323f;
+		m_bakeRays[i] = { r * cosf(a), y, r * sinf(a) };
+	}
+
+	// Matrices computed here: the workers only read them (bands and occluders)
+	for ( int i=0 ; i<m_entityManager.count ; i++ )
+	{
+		cpu_entity* pEntity = m_entityManager[i];
+		if ( pEntity->dead || pEntity->pMesh==nullptr || pEntity->pMaterial==nullptr || pEntity->pMaterial->lighting!=CPU_LIGHTING_BAKED )
+			continue;
+
+		pEntity->transform.GetInvWorld();
+	}
+
+	// One entity at a time, vertices split across the workers
+	for ( int i=0 ; i<m_entityManager.count ; i++ )
+	{
+		cpu_entity* pEntity = m_entityManager[i];
+		if ( pEntity->dead || pEntity->pMesh==nullptr || pEntity->pMaterial==nullptr || pEntity->pMaterial->lighting!=CPU_LIGHTING_BAKED )
+			continue;
+
+		m_pBakeEntity = pEntity;
+		pEntity->bakedLight.resize(pEntity->pMesh->vertices.size());
+		CPU_JOBS(m_bakeJobs);
+	}
+	m_pBakeEntity = nullptr;
+	m_invalidTiles = CPU_TILE_ALL;
+}
+
+void cpu_engine::Bake_Band(int iBand)
+{
+	cpu_entity* pEntity = m_pBakeEntity;
+	cpu_light& light = *m_device.GetLight();
+	XMMATRIX matWorld = XMLoadFloat4x4(&pEntity->transform.GetWorld());
+	XMMATRIX matNormal = XMMatrixTranspose(XMLoadFloat4x4(&pEntity->transform.GetInvWorld()));
+	XMVECTOR lightDir = XMVector3Normalize(XMLoadFloat3(&light.dir));
+
+	int min, max;
+	GetBand(iBand, (int)pEntity->pMesh->vertices.size(), min, max);
+	for ( int i=min ; i<max ; i++ )
+	{
+		const cpu_vertex& v = pEntity->pMesh->vertices[i];
+		XMVECTOR normal = XMVector3Normalize(XMVector3TransformNormal(XMLoadFloat3(&v.normal), matNormal));
+		XMVECTOR pos = XMVector3TransformCoord(XMLoadFloat3(&v.pos), matWorld);
+		cpu_ray ray;
+		XMStoreFloat3(&ray.pos, XMVectorAdd(pos, XMVectorScale(normal, CPU_BAKE_OFFSET)));
+
+		// Direct light (shadowed by the static entities)
+		float direct = XMVectorGetX(XMVector3Dot(normal, lightDir));
+		if ( direct>0.0f )
+		{
+			XMStoreFloat3(&ray.dir, lightDir);
+			if ( Bake_Occluded(ray, FLT_MAX) )
+				direct = 0.0f;
+		}
+		else
+			direct = 0.0f;
+
+		// Ambient occlusion (cosine weighted)
+		float open = 0.0f;
+		float total = 0.0f;
+		for ( int r=0 ; r<CPU_BAKE_AO_RAYS ; r++ )
+		{
+			XMVECTOR dir = XMLoadFloat3(&m_bakeRays[r]);
+			float ndotd = XMVectorGetX(XMVector3Dot(normal, dir));
+			if ( ndotd<0.0f )
+			{
+				dir = XMVectorNegate(dir);
+				ndotd = -ndotd;
+			}
+			XMStoreFloat3(&ray.dir, dir);
+			total += ndotd;
+			if ( Bake_Occluded(ray, CPU_BAKE_AO_DISTANCE)==false )
+				open += ndotd;
+		}
+		float ao = total>0.0f ? open / total : 1.0f;
+
+		pEntity->bakedLight[i] = direct + light.ambient * ao;
+	}
+}
+
+bool cpu_engine::Bake_Occluded(cpu_ray& ray, float maxDist)
+{
+	// Static entities only (baked material), ray direction is normalized: t is the world distance
+	XMFLOAT3 pt;
+	float t;
+	for ( int iEntity=0 ; iEntity<m_entityManager.count ; iEntity++ )
+	{
+		cpu_entity* pEntity = m_entityManager[iEntity];
+		if ( pEntity->dead || pEntity->pMesh==nullptr || pEntity->pMaterial==nullptr || pEntity->pMaterial->lighting!=CPU_LIGHTING_BAKED )
+			continue;
+
+		float enter, exit;
+		if ( cpu::RayAabb(ray, pEntity->aabb, enter, exit)==false || enter>maxDist )
+			continue;
+
+		cpu_ray rayL;
+		ray.ToLocal(rayL, XMLoadFloat4x4(&pEntity->transform.GetInvWorld()));
+		for ( size_t offset=0 ; offset<pEntity->pMesh->vertices.size() ; offset+=3 )
+		{
+			XMFLOAT3& a = pEntity->pMesh->vertices[offset+0].pos;
+			XMFLOAT3& b = pEntity->pMesh->vertices[offset+1].pos;
+			XMFLOAT3& c = pEntity->pMesh->vertices[offset+2].pos;
+			if ( cpu::RayTriangle(rayL, a, b, c, pt, &t) && t>CPU_BAKE_OFFSET && t<maxDist )
+				return true;
+		}
+	}
+	return false;
+}
+
+void cpu_engine::Render_AssignLightTile()
+{
+	// Tile depth range (view space) from the entity spheres
+	XMMATRIX matView = XMLoadFloat4x4(&m_camera.matView);
+	for ( int iEntity=0 ; iEntity<m_entityManager.count && m_lightManager.count ; iEntity++ )
+	{
+		cpu_entity* pEntity = m_entityManager[iEntity];
+		if ( pEntity->tile==0 )
+			continue;
+
+		float z = XMVectorGetZ(XMVector3TransformCoord(XMLoadFloat3(&pEntity->sphere.center), matView));
+		float minZ = z - pEntity->sphere.radius;
+		float maxZ = z + pEntity->sphere.radius;
+		for ( int i=0 ; i<m_tileCount ; i++ )
+		{
+			if ( ((pEntity->tile>>i) & 1)==0 )
+				continue;
+			cpu_tile& tile = m_tiles[i];
+			tile.minZ = std::min(tile.minZ, minZ);
+			tile.maxZ = std::max(tile.maxZ, maxZ);
+		}
+	}
+
+	// Light spheres against tile rectangles and depth ranges
+	ui64 lightTiles = 0;
+	int width = m_device.GetWidth();
+	int height = m_device.GetHeight();
+	XMMATRIX matViewProj = XMLoadFloat4x4(&m_camera.matViewProj);
+	for ( int iLight=0 ; iLight<m_lightManager.count ; iLight++ )
+	{
+		cpu_light* pLight = m_lightManager[iLight];
+		if ( pLight->dead || pLight->type==CPU_LIGHT_DIRECTIONAL || pLight->range<=0.0f )
+			continue;
+
+		float z = XMVectorGetZ(XMVector3TransformCoord(XMLoadFloat3(&pLight->pos), matView));
+		float minZ = z - pLight->range;
+		float maxZ = z + pLight->range;
+		if ( maxZ<m_camera.near || minZ>m_camera.far )
+			continue;
+
+		// Rectangle: whole screen when the sphere crosses the near plane
+		cpu_rectangle box;
+		if ( minZ<=m_camera.near )
+		{
+			box.minX = 0;
+			box.minY = 0;
+			box.maxX = width;
+			box.maxY = height;
+		}
+		else
+		{
+			cpu_aabb aabb;
+			aabb.min = { pLight->pos.x-pLight->range, pLight->pos.y-pLight->range, pLight->pos.z-pLight->range };
+			aabb.max = { pLight->pos.x+pLight->range, pLight->pos.y+pLight->range, pLight->pos.z+pLight->range };
+			if ( aabb.ToScreen(box, matViewProj, width, height)==false )
+				continue;
+		}
+
+		ui64 mask = GetTileMask(box);
+		for ( int i=0 ; i<m_tileCount ; i++ )
+		{
+			if ( ((mask>>i) & 1)==0 )
+				continue;
+			cpu_tile& tile = m_tiles[i];
+			if ( maxZ<tile.minZ || minZ>tile.maxZ )
+				continue;
+			tile.lights.push_back(pLight);
+			lightTiles |= 1ull << i;
+		}
+	}
+
+	// Lights are dynamic: their tiles are rendered again
+	m_invalidTiles |= lightTiles | m_lastLightTiles;
+	m_lastLightTiles = lightTiles;
+}
+
+void cpu_engine::Render_Invalidate()
+{
+	ui64 dirty = m_invalidTiles;
+	m_invalidTiles = 0;
+
+	// Camera, light, style, checkerboard, effects (applied again on the previous frame otherwise), shadows (cast anywhere)
+	if ( Render_HasGlobalChange() || m_incrementalEnabled==false || m_checkerboardEnabled || m_device.HasEffects() || m_shadowEnabled )
+		dirty = CPU_TILE_ALL;
+
+	// Entities
+	for ( int iEntity=0 ; iEntity<m_entityManager.count ; iEntity++ )
+	{
+		cpu_entity* pEntity = m_entityManager[iEntity];
+		ui64 tile = pEntity->dead || pEntity->clipped ? 0 : pEntity->tile;
+		bool changed = tile!=pEntity->lastTile || pEntity->pMesh!=pEntity->pLastMesh || pEntity->pMaterial!=pEntity->pLastMaterial;
+		if ( pEntity->pMaterial && (*pEntity->pMaterial==pEntity->lastMaterial)==false )
+			changed = true;
+		if ( tile && pEntity->transform.HasChanged() )
+			changed = true;
+		if ( tile && pEntity->pMaterial && pEntity->pMaterial->ps )
+			changed = true; // custom shaders may animate
+		if ( changed )
+			dirty |= tile | pEntity->lastTile;
+		pEntity->lastTile = tile;
+		pEntity->pLastMesh = pEntity->pMesh;
+		pEntity->pLastMaterial = pEntity->pMaterial;
+		if ( pEntity->pMaterial )
+			pEntity->lastMaterial = *pEntity->pMaterial;
+	}
+
+	// Particles
+	ui64 particleTiles = 0;
 	for ( int i=0 ; i<m_tileCount ; i++ )
-		m_stats.drawnTriangleCount += m_tiles[i].statsDrawnTriangleCount;
+	{
+		cpu_tile& tile = m_tiles[i];
+		if ( tile.particleCount || tile.particleLastCount )
+			particleTiles |= 1ULL << i;
+		tile.particleLastCount = tile.particleCount;
+	}
 
-	// UI
-	m_callback.onRender.Call(CPU_PASS_UI_BEGIN);
-	Render_UI();
-	m_callback.onRender.Call(CPU_PASS_UI_END);
+	// Splats also cover the neighbor tiles
+	if ( m_particleSplatCount || m_lastParticleSplatCount )
+	{
+		ui64 mask = particleTiles;
+		for ( int i=0 ; i<m_tileCount ; i++ )
+		{
+			if ( ((mask>>i) & 1)==0 )
+				continue;
+			cpu_tile& tile = m_tiles[i];
+			for ( int row=std::max(tile.row-1, 0) ; row<=std::min(tile.row+1, m_tileRowCount-1) ; row++ )
+			{
+				for ( int col=std::max(tile.col-1, 0) ; col<=std::min(tile.col+1, m_tileColCount-1) ; col++ )
+					particleTiles |= 1ULL << (row*m_tileColCount+col);
+			}
+		}
+	}
+	m_lastParticleSplatCount = m_particleSplatCount;
+	dirty |= particleTiles;
 
-	// Cursor
-	m_callback.onRender.Call(CPU_PASS_CURSOR_BEGIN);
-	Render_Cursor();
-	m_callback.onRender.Call(CPU_PASS_CURSOR_END);
+	// Sprites
+	for ( int iSprite=0 ; iSprite<m_spriteManager.count ; iSprite++ )
+	{
+		cpu_sprite* pSprite = m_spriteManager[iSprite];
+		cpu_rectangle box;
+		pSprite->GetBox(box);
+		if ( box==pSprite->lastBox && pSprite->pTexture==pSprite->pLastTexture )
+			continue;
 
-	// Style
-	if ( m_amigaStyle )
-		m_device.ToAmigaStyle();
+		dirty |= GetTileMask(box) | GetTileMask(pSprite->lastBox);
+		pSprite->lastBox = box;
+		pSprite->pLastTexture = pSprite->pTexture;
+	}
 
-	// Present
-	m_device.Present();
+	// Cursor
+	cpu_rectangle cursorBox;
+	if ( m_pCursor )
+	{
+		XMFLOAT2 pt;
+		GetCursor(pt);
+		cursorBox.minX = (int)pt.x;
+		cursorBox.minY = (int)pt.y;
+		cursorBox.maxX = cursorBox.minX + m_pCursor->width;
+		cursorBox.maxY = cursorBox.minY + m_pCursor->height;
+	}
+	if ( (cursorBox==m_cursorBox)==false || m_pCursor!=m_pLastCursor )
+	{
+		dirty |= GetTileMask(cursorBox) | GetTileMask(m_cursorBox);
+		m_cursorBox = cursorBox;
+		m_pLastCursor = m_pCursor;
+	}
+
+	// Tiles
+	m_dirtyTiles = dirty;
+	m_dirtyTileCount = 0;
+	for ( int i=0 ; i<m_tileCount ; i++ )
+	{
+		m_tiles[i].dirty = (dirty>>i) & 1 ? true : false;
+		if ( m_tiles[i].dirty )
+			m_dirtyTileCount++;
+	}
 }
 
-void cpu_engine::Render_SortZ()
+bool cpu_engine::Render_HasGlobalChange()
 {
-	// Entities
-	std::sort(m_entityManager.sortedList.begin(), m_entityManager.sortedList.begin()+m_entityManager.count, [](const cpu_entity* pA, const cpu_entity* pB) { return pA->view.z < pB->view.z; });
-	for ( int i=0 ; i<m_entityManager.count ; i++ )
-		m_entityManager.sortedList[i]->sortedIndex = i;
-
-	// Sprites
-	std::sort(m_spriteManager.sortedList.begin(), m_spriteManager.sortedList.begin()+m_spriteManager.count, [](const cpu_sprite* pA, const cpu_sprite* pB) { return pA->z < pB->z; });
-	for ( int i=0 ; i<m_spriteManager.count ; i++ )
-		m_spriteManager.sortedList[i]->sortedIndex = i;
+	cpu_light& light = *m_device.GetLight();
+	bool changed = false;
+	if ( memcmp(&m_lastViewProj, &m_camera.matViewProj, sizeof(XMFLOAT4X4)) )
+		changed = true;
+	else if ( memcmp(&m_lastLight.dir, &light.dir, sizeof(XMFLOAT3)) || m_lastLight.ambient!=light.ambient )
+		changed = true;
+	else if ( m_lastClear!=m_clear || memcmp(&m_lastClearColor, &m_clearColor, sizeof(XMFLOAT3)) )
+		changed = true;
+	else if ( memcmp(&m_lastGroundColor, &m_groundColor, sizeof(XMFLOAT3)) || memcmp(&m_lastSkyColor, &m_skyColor, sizeof(XMFLOAT3)) )
+		changed = true;
+	else if ( m_lastAmigaStyle!=m_amigaStyle || m_lastRenderBoxEnabled!=m_renderBoxEnabled )
+		changed = true;
+
+	m_lastViewProj = m_camera.matViewProj;
+	m_lastLight = light;
+	m_lastClear = m_clear;
+	m_lastClearColor = m_clearColor;
+	m_lastGroundColor = m_groundColor;
+	m_lastSkyColor = m_skyColor;
+	m_lastAmigaStyle = m_amigaStyle;
+	m_lastRenderBoxEnabled = m_renderBoxEnabled;
+	return changed;
 }
 
-void cpu_engine::Render_RecalculateMatrices()
+void cpu_engine::Render_Shadow()
 {
-	cpu_rt& rt = *m_device.GetRT();
+	if ( m_shadowEnabled==false )
+		return;
+	m_device.SetShadowMap(nullptr);
+
+	// Casters bounds
+	cpu_aabb bounds;
+	bool empty = true;
 	for ( int i=0 ; i<m_entityManager.count ; i++ )
 	{
 		cpu_entity* pEntity = m_entityManager[i];
-		pEntity->UpdateWorld(&m_camera, rt.width, rt.height);
+		if ( pEntity->dead || pEntity->visible==false || pEntity->castShadow==false || pEntity->pMesh==nullptr )
+			continue;
+
+		XMStoreFloat3(&bounds.min, empty ? XMLoadFloat3(&pEntity->aabb.min) : XMVectorMin(XMLoadFloat3(&bounds.min), XMLoadFloat3(&pEntity->aabb.min)));
+		XMStoreFloat3(&bounds.max, empty ? XMLoadFloat3(&pEntity->aabb.max) : XMVectorMax(XMLoadFloat3(&bounds.max), XMLoadFloat3(&pEntity->aabb.max)));
+		empty = false;
 	}
-}
+	if ( empty )
+		return;
 
-void cpu_engine::Render_ApplyClipping()
-{
-	m_stats.clipEntityCount = 0;
+	// Light view (dir points to the light): orthographic projection fitted to the bounds
+	XMVECTOR dir = XMVectorNegate(XMVector3Normalize(XMLoadFloat3(&m_device.GetLight()->dir)));
+	XMVECTOR up = fabsf(XMVectorGetY(dir))>0.99f ? CPU_XMRIGHT : CPU_XMUP;
+	XMVECTOR center = XMVectorScale(XMVectorAdd(XMLoadFloat3(&bounds.min), XMLoadFloat3(&bounds.max)), 0.5f);
+	XMMATRIX matView = XMMatrixLookToLH(center, dir, up);
+	XMVECTOR lo = XMVectorReplicate(FLT_MAX);
+	XMVECTOR hi = XMVectorReplicate(-FLT_MAX);
+	for ( int i=0 ; i<8 ; i++ )
+	{
+		XMVECTOR corner = XMVectorSet(i & 1 ? bounds.max.x : bounds.min.x, i & 2 ? bounds.max.y : bounds.min.y, i & 4 ? bounds.max.z : bounds.min.z, 1.0f);
+		corner = XMVector3TransformCoord(corner, matView);
+		lo = XMVectorMin(lo, corner);
+		hi = XMVectorMax(hi, corner);
+	}
+	XMFLOAT3 vlo, vhi;
+	XMStoreFloat3(&vlo, lo);
+	XMStoreFloat3(&vhi, hi);
+	XMMATRIX matProj = XMMatrixOrthographicOffCenterLH(vlo.x, vhi.x, vlo.y, vhi.y, vlo.z-CPU_EPSILON, vhi.z+0.01f);
+	XMMATRIX matViewProj = XMMatrixMultiply(matView, matProj);
+	XMStoreFloat4x4(&m_shadowCamera.matView, matView);
+	XMStoreFloat4x4(&m_shadowCamera.matProj, matProj);
+	XMStoreFloat4x4(&m_shadowCamera.matViewProj, matViewProj);
+
+	// World to shadow map pixels
+	float half = m_shadowMap.widthHalf;
+	XMMATRIX matPixel = XMMatrixMultiply(XMMatrixScaling(half, -half, 1.0f), XMMatrixTranslation(half, half, 0.0f));
+	XMStoreFloat4x4(&m_shadowMatrix, XMMatrixMultiply(matViewProj, matPixel));
+
+	// Caster rectangles in the map (bands skip the others)
+	m_shadowBoxes.resize(m_entityManager.count);
 	for ( int i=0 ; i<m_entityManager.count ; i++ )
 	{
 		cpu_entity* pEntity = m_entityManager[i];
-		pEntity->Clip(&m_camera, &m_stats.clipEntityCount);
+		cpu_rectangle& box = m_shadowBoxes[i];
+		box.minY = box.maxY = 0;
+		if ( pEntity->dead || pEntity->visible==false || pEntity->castShadow==false || pEntity->pMesh==nullptr )
+			continue;
+
+		XMMATRIX matWVP = XMMatrixMultiply(XMLoadFloat4x4(&pEntity->transform.GetWorld()), matViewProj);
+		if ( pEntity->pMesh->aabb.ToScreen(box, matWVP, m_shadowMap.width, m_shadowMap.height)==false )
+			box.minY = box.maxY = 0;
+	}
+
+	// Horizontal bands (one per job, the tile grid can change)
+	m_shadowBands.resize(m_tileCount);
+	for ( int i=0 ; i<m_tileCount ; i++ )
+	{
+		cpu_tile& band = m_shadowBands[i];
+		band.left = 0;
+		band.right = m_shadowMap.width;
+		GetBand(i, m_shadowMap.height, band.top, band.bottom);
+		band.row = i;
+		band.col = 0;
 	}
+
+	// Depth only (MT)
+	cpu_rt* pOldRT = m_device.SetRT(&m_shadowMap, false);
+	m_device.SetCamera(&m_shadowCamera);
+	CPU_JOBS(m_shadowJobs);
+	m_device.SetCamera(&m_camera);
+	m_device.SetRT(pOldRT, false);
+	m_device.SetShadowMap(&m_shadowMap, &m_shadowMatrix);
 }
 
-void cpu_engine::Render_AssignEntityTile()
+void cpu_engine::Render_BandShadow(int iBand)
 {
-	for ( int iEntity=0 ; iEntity<m_entityManager.count ; iEntity++ )
+	cpu_tile& band = m_shadowBands[iBand];
+	m_device.ClearDepth(&band);
+	for ( int i=0 ; i<m_entityManager.count ; i++ )
 	{
-		cpu_entity* pEntity = m_entityManager[iEntity];
-		if ( pEntity->dead || pEntity->clipped )
+		cpu_rectangle& box = m_shadowBoxes[i];
+		if ( box.maxY<=band.top || box.minY>=band.bottom )
 			continue;
 
-		if ( pEntity->box.IsEmpty() )
-			continue;
-
-		int minX = cpu::Clamp(pEntity->box.minX/m_tileWidth, 0, m_tileColCount-1);
-		int maxX = cpu::Clamp((pEntity->box.maxX-1)/m_tileWidth, 0, m_tileColCount-1);
-		int minY = cpu::Clamp(pEntity->box.minY/m_tileHeight, 0, m_tileRowCount-1);
-		int maxY = cpu::Clamp((pEntity->box.maxY-1)/m_tileHeight, 0, m_tileRowCount-1);
+		cpu_entity* pEntity = m_entityManager[i];
+		m_device.DrawMeshDepth(pEntity->pMesh, &pEntity->transform, &band);
+	}
+}
 
-		pEntity->tile = 0;
-		int offset = minY * m_tileColCount;
-		for ( int y=minY ; y<=maxY ; y++ )
-		{
-			for ( int x=minX ; x<=maxX ; x++ )
-			{
-				int index = offset + x;
-				pEntity->tile |= 1ULL << index;
-			}
-			offset += m_tileColCount;
-		}
+void cpu_engine::Render_TileClear(cpu_tile& tile)
+{
+	// Tile region only: no serial full frame pass, the memory stays in cache for the raster
+	m_device.ClearDepth(&tile);
+	switch ( m_clear )
+	{
+	case CPU_CLEAR_COLOR:
+		m_device.ClearColor(m_clearColor, &tile);
+		break;
+	case CPU_CLEAR_SKY:
+		m_device.ClearSky(m_groundColor, m_skyColor, &tile);
+		break;
 	}
 }
 
@@ -691,26 +1828,71 @@ void cpu_engine::Render_TileEntities(int iTile)
 {
 	cpu_tile& tile = m_tiles[iTile];
 	tile.statsDrawnTriangleCount = 0;
-	for ( int iEntity=0 ; iEntity<m_entityManager.count ; iEntity++ )
+	if ( tile.dirty==false )
+		return;
+
+	// Clear
+	Render_TileClear(tile);
+
+	// Depth prepass
+	for ( int iEntity=0 ; iEntity<m_snapshotCount ; iEntity++ )
 	{
-		cpu_entity* pEntity = m_entityManager.sortedList[iEntity];
-		if ( pEntity->dead || pEntity->clipped )
-			continue;
-	
-		bool entityHasTile = (pEntity->tile>>iTile) & 1 ? true : false;
+		cpu_entity_snapshot& entity = m_snapshots[iEntity];
+		if ( entity.prepass && ((entity.tile>>iTile) & 1) )
+			m_device.DrawMeshDepth(entity.pMesh, entity.pTransform, &tile);
+	}
+
+	// Snapshots: visible entities, front to back
+	for ( int iEntity=0 ; iEntity<m_snapshotCount ; iEntity++ )
+	{
+		cpu_entity_snapshot& entity = m_snapshots[iEntity];
+		bool entityHasTile = (entity.tile>>iTile) & 1 ? true : false;
 		if ( entityHasTile==false )
 			continue;
 
 		// OBB
 		if ( m_renderBoxEnabled )
 		{
-			XMMATRIX matrix = pEntity->obb.GetMatrix();
+			XMMATRIX matrix = entity.obb.GetMatrix();
 			m_device.DrawWireframeMesh(&m_meshBox, matrix, &tile);
 		}
 
-		// Mesh
-		m_device.DrawMesh(pEntity->pMesh, &pEntity->transform, pEntity->pMaterial, pEntity->depth, &tile);
+		// Transparent: second pass
+		if ( entity.transparent )
+			continue;
+
+		// Mesh (after the prepass: only the nearest surface is shaded)
+		int depth = entity.prepass ? CPU_DEPTH_EQUAL : entity.depth;
+		m_device.DrawMesh(entity.pMesh, entity.pTransform, entity.pMaterial, depth, &tile, entity.shadingRate, entity.pBakedLight);
 	}
+
+	// Transparent: back to front, depth test without write
+	for ( int iEntity=m_snapshotCount-1 ; iEntity>=0 ; iEntity-- )
+	{
+		cpu_entity_snapshot& entity = m_snapshots[iEntity];
+		if ( entity.transparent==false || ((entity.tile>>iTile) & 1)==0 )
+			continue;
+
+		m_device.DrawMesh(entity.pMesh, entity.pTransform, entity.pMaterial, entity.depth & ~CPU_DEPTH_WRITE, &tile, entity.shadingRate, entity.pBakedLight);
+	}
+
+	// Shading rate for the next frame
+	if ( m_autoShadingRateEnabled )
+		tile.shadingRate = (byte)m_device.EstimateShadingRate(&tile);
+}
+
+bool cpu_engine::Render_HasDepthPrepass(cpu_entity* pEntity)
+{
+	// Custom pixel shaders can discard and transparent materials show what is behind
+	if ( pEntity->pMaterial && (pEntity->pMaterial->ps || pEntity->pMaterial->blend!=CPU_BLEND_OPAQUE) )
+		return false;
+	return (pEntity->depth & CPU_DEPTH_READ) && (pEntity->depth & CPU_DEPTH_WRITE);
+}
+
+void cpu_engine::Render_TileReconstruct(int iTile)
+{
+	cpu_rt* pHistory = m_historyValid ? &m_history[m_historyIndex] : nullptr;
+	m_device.Reconstruct(pHistory, &m_history[m_historyIndex^1], m_historyViewProj, m_invViewProj, &m_tiles[iTile]);
 }
 
 void cpu_engine::Render_AssignParticleTile(int iTileForAssign)
@@ -724,6 +1906,7 @@ void cpu_engine::Render_AssignParticleTile(int iTileForAssign)
 	XMFLOAT4X4& vp = m_camera.matViewProj;
 	for ( int i=min ; i<max ; i++ )
 	{
+		m_particleData.tile[i] = 0;
 		float x = m_particleData.px[i];
 		float y = m_particleData.py[i];
 		float z = m_particleData.pz[i];
@@ -766,28 +1949,79 @@ void cpu_engine::Render_AssignParticleTile(int iTileForAssign)
 		m_particleData.sy[i] = (ui16)sy;
 		m_particleData.sz[i] = ndcZ;
 		tile.particleLocalCounts[iTile]++;
+
+		// Splat radius in pixels (limited to a tile: neighbor tiles draw the overflow)
+		const float size = m_particleData.radius[i];
+		float sr = size>0.0f ? size * m_camera.matProj._22 * rt.heightHalf * invW : -size;
+		sr = std::min(sr, (float)std::min(m_tileWidth, m_tileHeight));
+		m_particleData.sr[i] = sr;
+		if ( sr>=0.5f )
+			tile.particleSplatCount++;
 	}
 }
 
 void cpu_engine::Render_TileParticles(int iTile)
+{
+	if ( m_tiles[iTile].particleCount==0 && m_particleSplatCount==0 )
+		return;
+
+	switch ( m_device.GetRT()->depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		Render_TileParticlesDepth<cpu_depth_u16>(iTile);
+		break;
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		Render_TileParticlesDepth<cpu_depth_f32_reversed>(iTile);
+		break;
+	default:
+		Render_TileParticlesDepth<cpu_depth_f32>(iTile);
+		break;
+	}
+}
+
+template <typename D>
+void cpu_engine::Render_TileParticlesDepth(int iTile)
 {
 	cpu_rt& rt = *m_device.GetRT();
 	cpu_tile& tile = m_tiles[iTile];
-	if ( tile.particleCount==0 )
-		return;
+	typename D::type* depth = D::Buffer(rt);
+
+	// Splats of the neighbor tiles crossing this one (clipped: each tile only writes its own pixels)
+	if ( m_particleSplatCount )
+	{
+		for ( int row=std::max(tile.row-1, 0) ; row<=std::min(tile.row+1, m_tileRowCount-1) ; row++ )
+		{
+			for ( int col=std::max(tile.col-1, 0) ; col<=std::min(tile.col+1, m_tileColCount-1) ; col++ )
+			{
+				cpu_tile& bin = m_tiles[row*m_tileColCount+col];
+				for ( int i=0 ; i<bin.particleCount && &bin!=&tile ; ++i )
+				{
+					const int p = m_particleData.sort[bin.particleOffset+i];
+					if ( m_particleData.sr[p]>=0.5f )
+						Render_ParticleSplat<D>(p, tile);
+				}
+			}
+		}
+	}
 
 	const int offset = tile.particleOffset;
 	for ( int i=0 ; i<tile.particleCount ; ++i )
 	{
 		const int p = m_particleData.sort[offset+i];
+		if ( m_particleData.sr[p]>=0.5f )
+		{
+			Render_ParticleSplat<D>(p, tile);
+			continue;
+		}
+
 		const int sx = m_particleData.sx[p];
 		const int sy = m_particleData.sy[p];
 		const float sz = m_particleData.sz[p];
 		const int pix = sy * rt.width + sx;
 
-		if ( sz>=rt.depthBuffer[pix] )
+		const typename D::type zEnc = D::Encode(sz);
+		if ( D::Test(zEnc, depth[pix])==false )
 			continue;
-		rt.depthBuffer[pix] = sz;
 
 		switch ( m_particleData.blend[p] )
 		{
@@ -805,6 +2039,7 @@ void cpu_engine::Render_TileParticles(int iTile)
 			}
 			case CPU_PARTICLE_OPAQUE:
 			{
+				depth[pix] = zEnc;
 				rt.colorBuffer[pix] = cpu::ToBGR(m_particleData.r[p], m_particleData.g[p], m_particleData.b[p]);
 				break;
 			}
@@ -812,39 +2047,232 @@ void cpu_engine::Render_TileParticles(int iTile)
 	}
 }
 
+template <typename D>
+void cpu_engine::Render_ParticleSplat(int p, cpu_tile& tile)
+{
+	cpu_rt& rt = *m_device.GetRT();
+	typename D::type* depth = D::Buffer(rt);
+	const float cx = (float)m_particleData.sx[p] + 0.5f;
+	const float cy = (float)m_particleData.sy[p] + 0.5f;
+	const float radius = m_particleData.sr[p];
+
+	// Splat box clipped to the tile
+	const int minX = std::max((int)(cx - radius), tile.left);
+	const int maxX = std::min((int)(cx + radius) + 1, tile.right);
+	const int minY = std::max((int)(cy - radius), tile.top);
+	const int maxY = std::min((int)(cy + radius) + 1, tile.bottom);
+	if ( minX>=maxX || minY>=maxY )
+		return;
+
+	// Additive fades with the age, opaque is a disc
+	const bool additive = m_particleData.blend[p]==CPU_PARTICLE_INTENSITY;
+	float a = 1.0f;
+	if ( additive )
+	{
+		a = 1.0f - m_particleData.age[p] * m_particleData.invDuration[p];
+		a *= a;
+	}
+	const typename D::type zEnc = D::Encode(m_particleData.sz[p]);
+	const ui32 opaque = cpu::ToBGR(m_particleData.r[p], m_particleData.g[p], m_particleData.b[p]);
+	const __m128 color = _mm_mul_ps(_mm_setr_ps(m_particleData.b[p], m_particleData.g[p], m_particleData.r[p], 0.0f), _mm_set1_ps(255.0f * a));
+	const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const __m128 center = _mm_set1_ps(cx);
+	const __m128 invR2 = _mm_set1_ps(1.0f / (radius * radius));
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 zero = _mm_setzero_ps();
+	const __m128i zero8 = _mm_setzero_si128();
+	alignas(16) float w[4];
+	alignas(16) ui32 px[4];
+
+	for ( int y=minY ; y<maxY ; y++ )
+	{
+		const float dy = (float)y + 0.5f - cy;
+		const __m128 dy2 = _mm_set1_ps(dy * dy);
+		ui32* colorRow = rt.colorBuffer.data() + y * rt.width;
+		typename D::type* depthRow = depth + y * rt.width;
+		for ( int x=minX ; x<maxX ; x+=4 )
+		{
+			// Falloff of 4 pixels: (1 - d^2/r^2)^2
+			__m128 dx = _mm_sub_ps(_mm_add_ps(_mm_set1_ps((float)x), lane), center);
+			__m128 f = _mm_max_ps(zero, _mm_sub_ps(one, _mm_mul_ps(_mm_add_ps(_mm_mul_ps(dx, dx), dy2), invR2)));
+			_mm_store_ps(w, _mm_mul_ps(f, f));
+
+			// Depth test (outside lanes get no weight)
+			const int n = std::min(4, maxX - x);
+			int visible = 0;
+			for ( int k=0 ; k<4 ; k++ )
+			{
+				if ( k>=n || w[k]<=0.0f || D::Test(zEnc, depthRow[x+k])==false )
+					w[k] = 0.0f;
+				else
+					visible++;
+			}
+			if ( visible==0 )
+				continue;
+
+			// Opaque: depth write
+			if ( additive==false )
+			{
+				for ( int k=0 ; k<n ; k++ )
+				{
+					if ( w[k]>0.0f )
+					{
+						depthRow[x+k] = zEnc;
+						colorRow[x+k] = opaque;
+					}
+				}
+				continue;
+			}
+
+			// Additive: 4 pixels at once, saturated, no depth write
+			memcpy(px, colorRow + x, n * sizeof(ui32));
+			__m128i dst = _mm_load_si128((const __m128i*)px);
+			__m128i add01 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(w[0]))), _mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(w[1]))));
+			__m128i add23 = _mm_packs_epi32(_mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(w[2]))), _mm_cvtps_epi32(_mm_mul_ps(color, _mm_set1_ps(w[3]))));
+			__m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(dst, zero8), add01);
+			__m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(dst, zero8), add23);
+			_mm_store_si128((__m128i*)px, _mm_packus_epi16(lo, hi));
+			memcpy(colorRow + x, px, n * sizeof(ui32));
+		}
+	}
+}
+
 void cpu_engine::Render_Entities()
 {
-	CPU_JOBS(m_entityJobs);
+	Render_Snapshot();
+
+	if ( m_checkerboardEnabled )
+		m_device.SetCheckerboard(m_checkerboardPhase);
+
+	if ( m_pipelineEnabled==false )
+	{
+		CPU_JOBS(m_entityJobs);
+		return;
+	}
+
+	// Camera and light: the update can change them before Render_Wait
+	m_snapshotCamera = m_camera;
+	m_pLiveLight = m_device.GetLight();
+	m_snapshotLight = *m_pLiveLight;
+	m_device.SetCamera(&m_snapshotCamera);
+	m_device.SetLight(&m_snapshotLight);
+
+	// Point and spot lights: the tiles point to copies (same index as the manager)
+	if ( (int)m_snapshotLights.size()<m_lightManager.count )
+		m_snapshotLights.resize(m_lightManager.count);
+	for ( int i=0 ; i<m_lightManager.count ; i++ )
+		m_snapshotLights[i] = *m_lightManager[i];
+	for ( int i=0 ; i<m_tileCount ; i++ )
+	{
+		for ( cpu_light*& pLight : m_tiles[i].lights )
+			pLight = &m_snapshotLights[pLight->index];
+	}
+
+	// Posted only (CPU_JOBS without the wait)
+	m_nextTile = 0;
+	for ( int i=0 ; i<m_threadCount ; i++ )
+		m_threads[i].SetJob(&m_entityJobs[i]);
+	m_barrier.Post();
+	m_framePending = true;
 }
 
-void cpu_engine::Render_Particles()
+void cpu_engine::Render_Snapshot()
 {
-	// Reset
-	memset(m_particleData.tile, 0, m_particleData.alive);
+	// Sorted, without the dead and clipped entities (copies only when the next update runs meanwhile)
+	if ( (int)m_snapshots.size()<m_entityManager.count )
+		m_snapshots.resize(m_entityManager.count);
+
+	m_snapshotCount = 0;
+	for ( int iEntity=0 ; iEntity<m_entityManager.count ; iEntity++ )
+	{
+		cpu_entity* pEntity = m_entityManager.sortedList[iEntity];
+		if ( pEntity->dead || pEntity->clipped || pEntity->pMesh==nullptr )
+			continue;
+
+		bool prepass = m_depthPrepassEnabled && Render_HasDepthPrepass(pEntity);
+		m_snapshots[m_snapshotCount++].Set(pEntity, prepass, m_pipelineEnabled);
+	}
+}
+
+void cpu_engine::Render_Flush()
+{
+	// Pending frame finished with the settings it started with
+	if ( m_framePending )
+		Render_Finish();
+}
+
+void cpu_engine::Render_Wait()
+{
+	if ( m_framePending==false )
+		return;
+
+	m_barrier.Wait();
+	m_framePending = false;
+
+	// Live camera and light (unless the update has set another light)
+	m_device.SetCamera(&m_camera);
+	if ( m_device.GetLight()==&m_snapshotLight )
+		m_device.SetLight(m_pLiveLight);
+}
+
+void cpu_engine::Render_Reconstruct()
+{
+	if ( m_checkerboardEnabled==false )
+		return;
+
+	// Current frame to world
+	XMMATRIX matViewProj = XMLoadFloat4x4(&m_camera.matViewProj);
+	XMStoreFloat4x4(&m_invViewProj, XMMatrixInverse(nullptr, matViewProj));
+
+	// Missing pixels (MT)
+	CPU_JOBS(m_reconstructJobs);
+	m_device.SetCheckerboard(-1);
+
+	// History
+	m_historyViewProj = m_camera.matViewProj;
+	m_historyIndex ^= 1;
+	m_historyValid = true;
+	m_checkerboardPhase ^= 1;
+}
 
-	// Pre-render
-	CPU_JOBS(m_particleSpaceJobs);
+void cpu_engine::Render_BinParticles()
+{
+	// Tiles assigned by the space task (each particle clears its own byte)
+	m_particleSplatCount = 0;
+	for ( int i=0 ; i<m_tileCount ; i++ )
+		m_particleSplatCount += m_tiles[i].particleSplatCount;
+
+	// Count matrix: offset of each (range, tile) pair, ranges in order (the scatter tasks write the indices)
+	int offset = 0;
 	for ( int i=0 ; i<m_tileCount ; i++ )
 	{
+		cpu_tile& tile = m_tiles[i];
+		tile.particleOffset = offset;
 		for ( int j=0 ; j<m_tileCount ; j++ )
-			m_tiles[i].particleCount += m_tiles[j].particleLocalCounts[i];
-		if ( i>0 )
 		{
-			m_tiles[i].particleOffset = m_tiles[i-1].particleOffset + m_tiles[i-1].particleCount;
-			m_tiles[i].particleOffsetTemp = m_tiles[i].particleOffset;
+			m_tiles[j].particleLocalOffsets[i] = offset;
+			offset += m_tiles[j].particleLocalCounts[i];
 		}
+		tile.particleCount = offset - tile.particleOffset;
 	}
-	for ( int i=0 ; i<m_particleData.alive ; i++ )
+}
+
+void cpu_engine::Render_ScatterParticles(int iTileForAssign)
+{
+	int min, max;
+	GetParticleRange(min, max, iTileForAssign);
+
+	int* offsets = m_tiles[iTileForAssign].particleLocalOffsets.data();
+	for ( int i=min ; i<max ; i++ )
 	{
 		byte iTile = m_particleData.tile[i];
 		if ( iTile )
-		{
-			cpu_tile& tile = m_tiles[iTile-1];
-			m_particleData.sort[tile.particleOffsetTemp++] = i;
-		}
+			m_particleData.sort[offsets[iTile-1]++] = i;
 	}
+}
 
-	// Render
+void cpu_engine::Render_Particles()
+{
 	CPU_JOBS(m_particleRenderJobs);
 }
 
@@ -856,7 +2284,18 @@ void cpu_engine::Render_UI()
 		if ( pSprite->dead || pSprite->visible==false || pSprite->pTexture==nullptr )
 			continue;
 
-		m_device.DrawSprite(pSprite);
+		if ( m_dirtyTileCount==m_tileCount )
+		{
+			m_device.DrawSprite(pSprite);
+			continue;
+		}
+
+		ui64 mask = GetTileMask(pSprite->lastBox) & m_dirtyTiles;
+		for ( int i=0 ; mask ; i++, mask>>=1 )
+		{
+			if ( mask & 1 )
+				m_device.DrawSprite(pSprite, &m_tiles[i]);
+		}
 	}
 }
 
@@ -865,7 +2304,81 @@ void cpu_engine::Render_Cursor()
 	if ( m_pCursor==nullptr )
 		return;
 
-	XMFLOAT2 pt;
-	GetCursor(pt);
-	m_device.DrawTexture(m_pCursor, (int)pt.x, (int)pt.y);	
+	if ( m_dirtyTileCount==m_tileCount )
+	{
+		m_device.DrawTexture(m_pCursor, m_cursorBox.minX, m_cursorBox.minY);
+		return;
+	}
+
+	ui64 mask = GetTileMask(m_cursorBox) & m_dirtyTiles;
+	for ( int i=0 ; mask ; i++, mask>>=1 )
+	{
+		if ( mask & 1 )
+			m_device.DrawTexture(m_pCursor, m_cursorBox.minX, m_cursorBox.minY, &m_tiles[i]);
+	}
+}
+
+void cpu_engine::Render_Style()
+{
+	if ( m_amigaStyle==false )
+		return;
+
+	// Incremental: dirty tiles only
+	Post(m_dirtyTileCount==m_tileCount ? CPU_POST_AMIGA : CPU_POST_AMIGA_TILES);
+}
+
+void cpu_engine::Render_BandPost(int iBand)
+{
+	cpu_rt& rt = *m_device.GetRT();
+	int minY, maxY;
+	GetBand(iBand, rt.height, minY, maxY);
+	switch ( m_postOp )
+	{
+	case CPU_POST_CLEAR:
+		std::fill(rt.colorBuffer.begin() + minY*rt.width, rt.colorBuffer.begin() + maxY*rt.width, m_postColor);
+		break;
+	case CPU_POST_BLUR_ROWS:
+		GetBand(iBand, m_postHeight, minY, maxY);
+		cpu_img32::GaussianBlurRows(m_postImage, m_postBuffer.data(), m_postWidth, m_postHeight, m_postRadius, minY, maxY);
+		break;
+	case CPU_POST_BLUR_COLS:
+	{
+		// Vertical pass: bands of columns, rows walked in memory order
+		static thread_local std::vector<int> s_sums;
+		int minX, maxX;
+		GetBand(iBand, m_postWidth, minX, maxX);
+		s_sums.resize((size_t)(maxX-minX) * 4);
+		cpu_img32::GaussianBlurCols(m_postImage, m_postBuffer.data(), m_postWidth, m_postHeight, m_postRadius, minX, maxX, s_sums.data());
+		break;
+	}
+	case CPU_POST_DOWNSAMPLE:
+		GetBand(iBand, m_postHeight, minY, maxY);
+		cpu_img32::Downsample((byte*)rt.colorBuffer.data(), rt.width, rt.height, m_postImage, cpu_img32::GetPyramidFactor(m_postRadius), minY, maxY);
+		break;
+	case CPU_POST_UPSAMPLE:
+		cpu_img32::Upsample(m_postImage, m_postWidth, m_postHeight, (byte*)rt.colorBuffer.data(), rt.width, rt.height, minY, maxY);
+		break;
+	case CPU_POST_BLEND:
+		cpu_img32::AlphaBlend((byte*)m_pPostRT->colorBuffer.data(), m_pPostRT->width, m_pPostRT->height, (byte*)rt.colorBuffer.data(), rt.width, rt.height, 0, minY, 0, minY, rt.width, maxY-minY);
+		break;
+	case CPU_POST_AMIGA:
+		cpu_img32::ToAmigaPalette((byte*)rt.colorBuffer.data(), rt.width, rt.height, 0, minY, rt.width, maxY-minY);
+		break;
+	case CPU_POST_AMIGA_TILES:
+		if ( m_tiles[iBand].dirty )
+			m_device.ToAmigaStyle(&m_tiles[iBand]);
+		break;
+	case CPU_POST_EFFECTS:
+		m_device.ApplyEffects(&m_tiles[iBand]);
+		break;
+	}
+}
+
+void cpu_engine::Render_Effects()
+{
+	if ( m_device.HasEffects()==false )
+		return;
+
+	Post(CPU_POST_EFFECTS);
+	m_device.ResolveEffects();
 }
@@ -3,8 +3,12 @@
 class cpu_engine
 {
 public:
+	friend cpu_job_task;
 	friend cpu_job_entity;
-	friend cpu_job_particle_space;
+	friend cpu_job_reconstruct;
+	friend cpu_job_bake;
+	friend cpu_job_shadow;
+	friend cpu_job_post;
 	friend cpu_job_particle_render;
 
 public:
@@ -28,6 +32,71 @@ public:
 	cpu_stats* GetStats() { return &m_stats; }
 	void EnableRender(bool enabled = true) { m_renderEnabled = enabled; }
 	void EnableBoxRender(bool enabled = true) { m_renderBoxEnabled = enabled; }
+	void EnableAutoShadingRate(bool enabled = true);
+
+	// Placement: CPU_PLACEMENT_xxx flags, the workers are created again between two frames.
+	// The topology and the processor of each worker show up in GetStats().
+	void SetThreadPlacement(int placement);
+	int GetThreadPlacement() { return m_placement; }
+	cpu_topology* GetTopology() { return &m_topology; }
+
+	// Threads and tiles: applied between two frames, 0 keeps the automatic value (placement, grid from the thread count).
+	// The count also applies without CPU_CONFIG_MT. At most CPU_THREAD_MAX threads and CPU_TILE_MAX tiles.
+	void SetThreadCount(int count);
+	void SetTileGrid(int colCount, int rowCount);
+	int GetThreadCount() { return m_threadCount; }
+	int GetTileCount() { return m_tileCount; }
+
+	// Sweep: each configuration runs CPU_SWEEP_FRAMES frames and records its frame time, the previous settings are restored at the end.
+	// Without AddSweep, StartSweep measures 1 to the logical processor count threads with the automatic grid.
+	void AddSweep(int threadCount, int tileColCount = 0, int tileRowCount = 0);
+	void StartSweep(int frames = CPU_SWEEP_FRAMES);
+	bool IsSweeping() { return m_sweepIndex!=-1; }
+	std::vector<cpu_sweep>& GetSweepResults() { return m_sweeps; }
+	bool SaveSweepResults(const char* path);
+
+	// Incremental: only tiles touched by a change are cleared and rendered again, others keep the previous frame.
+	// Anything drawn by the application in a pass must be invalidated during the update, as well as changes to the
+	// data behind material values or textures.
+	void EnableIncrementalRender(bool enabled = true);
+	void Invalidate();
+	void Invalidate(int x, int y, int w, int h);
+
+	// Clear: each tile clears its own region at the start of its entity job.
+	// Anything drawn before CPU_PASS_ENTITY_END (clear and entity begin passes) is overwritten.
+
+	// Pipeline: the workers rasterize the entities of frame N while the main thread runs the update of frame N+1
+	// (physics, FSM, emitters, audio, callback), one frame of latency. Entities, camera, lights and materials are
+	// snapshotted, meshes and textures are not (do not edit or release them during the update). The frame is finished
+	// (particles, effects, UI, present) before the purge. Post-process functions stay in the render passes.
+	void EnablePipeline(bool enabled = true);
+
+	// Depth prepass: opaque entities (default pixel shader, depth read and write) fill the tile depth first,
+	// the color pass then shades only the visible pixels (CPU_DEPTH_EQUAL, no write).
+	void EnableDepthPrepass(bool enabled = true);
+
+	// Bake: entities with a CPU_LIGHTING_BAKED material store the device light and the ambient occlusion per vertex.
+	// They are static (moving one needs a new bake) and only occlude each other. Done by the workers at the next frame.
+	void BakeLighting();
+
+	// Shadow: the light renders the casters (castShadow) in a depth map fitted to their bounds, Gouraud and Lambert sample it.
+	void EnableShadow(bool enabled = true, int size = CPU_SHADOW_SIZE);
+
+	// Effects: GetDevice()->AddTint, AddAmigaStyle, AddBlur and AddBlend build a chain applied after the particles, one pass per tile.
+
+	// Checkerboard: half of the entity pixels are shaded each frame, the others are reprojected from the previous frame.
+	// Draw in CPU_PASS_ENTITY_END rather than CPU_PASS_ENTITY_BEGIN, reconstruction overwrites the missing pixels.
+	void EnableCheckerboardRender(bool enabled = true);
+
+	// Resolution: the render size follows the frame time (present excluded) and the window upscales it.
+	// UI coordinates are in render pixels, use GetDevice()->GetWidth() and GetHeight() to place sprites.
+	void EnableDynamicResolution(bool enabled = true, float targetFrameTime = CPU_RESOLUTION_TARGET);
+	void SetRenderScale(float scale);
+	float GetRenderScale() { return m_renderScale; }
+
+	// Depth: CPU_DEPTH_FORMAT_U16 halves the depth bandwidth, CPU_DEPTH_FORMAT_F32_REVERSED keeps the precision in the distance.
+	void SetDepthFormat(int format);
+	int GetDepthFormat() { return m_device.GetDepthFormat(); }
 
 	void ClearManagers();
 	template <typename T>
@@ -37,6 +106,7 @@ public:
 	cpu_particle_emitter* CreateParticleEmitter();
 	cpu_rt* CreateRT(bool depth = true);
 	cpu_player* CreatePlayer();
+	cpu_light* CreateLight(int type = CPU_LIGHT_POINT);
 	template <typename T>
 	cpu_fsm<T>* Release(cpu_fsm<T>* pFSM);
 	cpu_entity* Release(cpu_entity* pEntity);
@@ -44,6 +114,7 @@ public:
 	cpu_particle_emitter* Release(cpu_particle_emitter* pEmitter);
 	cpu_rt* Release(cpu_rt* pRT);
 	cpu_player* Release(cpu_player* pPlayer);
+	cpu_light* Release(cpu_light* pLight);
 
 	void SetCursor(cpu_texture* pTexture);
 	void SetCursor(XMFLOAT2& pt);
@@ -54,9 +125,31 @@ public:
 
 	cpu_entity* HitEntity(cpu_hit& hit, cpu_ray& ray);
 
+	// Post-process: the current render target is split in horizontal bands processed by the workers.
+	// Callable from the render passes (main thread).
+	cpu_rt* SetRT(cpu_rt* pRT, bool copyDepth = true) { return m_device.SetRT(pRT, copyDepth); }
+	cpu_rt* SetMainRT(bool copyDepth = true) { return m_device.SetMainRT(copyDepth); }
+	void ClearColor();
+	void ClearColor(XMFLOAT3& rgb);
+	void Blur(int radius);
+	void AlphaBlend(cpu_rt* pRT);
+	void ToAmigaStyle();
+
 	int GetTotalTriangleCount();
 
+	// Parallel: [begin, end) split in chunks of at least grain items, run by the workers and the calling thread.
+	// Callable from the update (callback, FSM) and nestable. Inline when the workers are busy (pipeline, tile jobs).
+	void ParallelFor(int begin, int end, int grain, const std::function<void(int min, int max)>& func);
+	template <typename T>
+	T ParallelReduce(int begin, int end, int grain, T identity, const std::function<T(int min, int max)>& map, const std::function<T(const T& a, const T& b)>& combine);
+
 private:
+	void CreateThreads(int width, int height);
+	void StartThreads();
+	void StopThreads();
+	void CreateTiles(int width, int height);
+	void Resize(int width, int height);
+
 	void Update();
 	void Update_Reset();
 	void Update_Physics();
@@ -66,17 +159,51 @@ private:
 	void Update_Purge();
 
 	void Render();
+	void Render_Threads();
+	void Render_Sweep(float workTime);
+	void Sweep_Apply(int index);
+	void Render_Resolution();
+	void Render_Prepare();
 	void Render_SortZ();
-	void Render_RecalculateMatrices();
-	void Render_ApplyClipping();
-	void Render_AssignEntityTile();
+	void Render_PrepareEntities(int min, int max);
+	void Render_Bake();
+	void Bake_Band(int iBand);
+	bool Bake_Occluded(cpu_ray& ray, float maxDist);
+	void Render_AssignLightTile();
+	void Render_Invalidate();
+	void Render_Shadow();
+	void Render_BandShadow(int iBand);
+	bool Render_HasGlobalChange();
+	void Render_TileClear(cpu_tile& tile);
 	void Render_TileEntities(int iTile);
+	bool Render_HasDepthPrepass(cpu_entity* pEntity);
+	void Render_TileReconstruct(int iTile);
+	void Render_BandPost(int iBand);
+	cpu_task* Render_CompactParticles();
 	void Render_AssignParticleTile(int iTileForAssign);
 	void Render_TileParticles(int iTile);
+	template <typename D>
+	void Render_TileParticlesDepth(int iTile);
+	template <typename D>
+	void Render_ParticleSplat(int p, cpu_tile& tile);
 	void Render_Entities();
+	void Render_Snapshot();
+	void Render_Flush();
+	void Render_Wait();
+	void Render_Finish();
+	void Render_Reconstruct();
+	void Render_BinParticles();
+	void Render_ScatterParticles(int iTileForAssign);
 	void Render_Particles();
+	void Render_Effects();
 	void Render_UI();
 	void Render_Cursor();
+	void Render_Style();
+
+	ui64 GetTileMask(cpu_rectangle& box);
+	void GetBand(int iBand, int size, int& min, int& max);
+	void RunTasks();
+	void Post(int op);
 
 	void OnStart() {}
 	void OnUpdate() {}
@@ -97,6 +224,7 @@ private:
 	// Options
 	bool m_renderEnabled;
 	bool m_renderBoxEnabled;
+	bool m_autoShadingRateEnabled;
 
 	// Window
 	cpu_window m_window;
@@ -106,6 +234,15 @@ private:
 
 	// Camera
 	cpu_camera m_camera;
+
+	// Resolution
+	bool m_dynamicResolutionEnabled;
+	float m_targetFrameTime;
+	float m_renderScale;
+	float m_workTime;
+	int m_resolutionCooldown;
+	LARGE_INTEGER m_frameStart;
+	LARGE_INTEGER m_frameFrequency;
 	
 	// Tile
 	int m_tileWidth;
@@ -116,23 +253,115 @@ private:
 	std::vector<cpu_tile> m_tiles;
 	cpu_atomic<int> m_nextTile;
 
+	// Incremental
+	bool m_incrementalEnabled;
+	ui64 m_invalidTiles;
+	ui64 m_dirtyTiles;
+	int m_dirtyTileCount;
+	XMFLOAT4X4 m_lastViewProj;
+	cpu_light m_lastLight;
+	int m_lastClear;
+	XMFLOAT3 m_lastClearColor;
+	XMFLOAT3 m_lastGroundColor;
+	XMFLOAT3 m_lastSkyColor;
+	bool m_lastAmigaStyle;
+	bool m_lastRenderBoxEnabled;
+	ui64 m_lastLightTiles;
+
+	// Checkerboard
+	bool m_checkerboardEnabled;
+	int m_checkerboardPhase;
+	bool m_historyValid;
+	int m_historyIndex;
+	cpu_rt m_history[2];
+	XMFLOAT4X4 m_historyViewProj;
+	XMFLOAT4X4 m_invViewProj;
+
+	// Pipeline
+	bool m_pipelineEnabled;
+	bool m_framePending;
+	std::vector<cpu_entity_snapshot> m_snapshots;
+	int m_snapshotCount;
+	cpu_camera m_snapshotCamera;
+	cpu_light m_snapshotLight;
+	std::vector<cpu_light> m_snapshotLights;
+	cpu_light* m_pLiveLight;
+
+	// Depth prepass
+	bool m_depthPrepassEnabled;
+
+	// Bake
+	bool m_bakeRequested;
+	cpu_entity* m_pBakeEntity;
+	std::vector<XMFLOAT3> m_bakeRays;
+
+	// Shadow
+	bool m_shadowEnabled;
+	cpu_rt m_shadowMap;
+	cpu_camera m_shadowCamera;
+	XMFLOAT4X4 m_shadowMatrix;
+	std::vector<cpu_tile> m_shadowBands;
+	std::vector<cpu_rectangle> m_shadowBoxes;
+
+	// Post
+	int m_postOp;
+	int m_postRadius;
+	ui32 m_postColor;
+	cpu_rt* m_pPostRT;
+	byte* m_postImage;
+	int m_postWidth;
+	int m_postHeight;
+	std::vector<byte> m_postBuffer;
+	std::vector<byte> m_postSmall;
+
 	// Mesh
 	cpu_mesh m_meshBox;
 
 	// Jobs
+	cpu_topology m_topology;
+	int m_placement;
+	bool m_threadsChanged;
+	std::vector<int> m_workerProcessors;
+	int m_mainProcessor;
+	bool m_mainPinned;
+	ui32 m_mainThreadID;
+	int m_requestedThreadCount;
+	int m_requestedTileColCount;
+	int m_requestedTileRowCount;
 	int m_threadCount;
 	std::vector<cpu_thread_job> m_threads;
+	cpu_barrier m_barrier;
+	cpu_scheduler m_scheduler;
+	std::vector<int> m_clipCounts;
+	std::vector<int> m_particleChunks;
+	int m_particleSurvivors;
+	std::vector<cpu_job_task> m_taskJobs;
 	std::vector<cpu_job_entity> m_entityJobs;
-	std::vector<cpu_job_particle_physics> m_particlePhysicsJobs;
-	std::vector<cpu_job_particle_space> m_particleSpaceJobs;
+	std::vector<cpu_job_reconstruct> m_reconstructJobs;
+	std::vector<cpu_job_bake> m_bakeJobs;
+	std::vector<cpu_job_shadow> m_shadowJobs;
+	std::vector<cpu_job_post> m_postJobs;
 	std::vector<cpu_job_particle_render> m_particleRenderJobs;
 
+	// Sweep
+	std::vector<cpu_sweep> m_sweeps;
+	int m_sweepIndex;
+	int m_sweepFrame;
+	int m_sweepFrames;
+	int m_sweepThreadCount;
+	int m_sweepTileColCount;
+	int m_sweepTileRowCount;
+
 	// Particle
 	cpu_particle_data m_particleData;
+	int m_particleSplatCount;
+	int m_lastParticleSplatCount;
 	cpu_particle_physics m_particlePhysics;
 
 	// Cursor
 	cpu_texture* m_pCursor;
+	cpu_texture* m_pLastCursor;
+	cpu_rectangle m_cursorBox;
 
 	// Managers
 	cpu_manager<cpu_fsm_base> m_fsmManager;
@@ -141,6 +370,7 @@ private:
 	cpu_manager<cpu_sprite> m_spriteManager;
 	cpu_manager<cpu_rt> m_rtManager;
 	cpu_manager<cpu_player> m_playerManager;
+	cpu_manager<cpu_light> m_lightManager;
 
 	// Callback
 	cpu_callback m_callback;
@@ -163,3 +393,21 @@ cpu_fsm<T>* cpu_engine::Release(cpu_fsm<T>* pFSM)
 	m_fsmManager.Release(pFSM);
 	return nullptr;
 }
+
+template <typename T>
+T cpu_engine::ParallelReduce(int begin, int end, int grain, T identity, const std::function<T(int min, int max)>& map, const std::function<T(const T& a, const T& b)>& combine)
+{
+	// One partial per worker (first one: inline), combine must be associative and commutative
+	std::vector<T> partials(m_scheduler.GetWorkerCount()+1, identity);
+	ParallelFor(begin, end, grain, [&](int min, int max)
+	{
+		T value = map(min, max);
+		T& partial = partials[cpu_scheduler::GetCurrentWorker()+1];
+		partial = combine(partial, value);
+	});
+
+	T result = identity;
+	for ( const T& partial : partials )
+		result = combine(result, partial);
+	return result;
+}
@@ -10,8 +10,13 @@ cpu_entity::cpu_entity()
 	lifetime = 0.0f;
 	tile = 0;
 	depth = CPU_DEPTH_READ | CPU_DEPTH_WRITE;
+	shadingRate = CPU_SHADING_RATE_1X1;
 	visible = true;
+	castShadow = true;
 	clipped = false;
+	lastTile = 0;
+	pLastMesh = nullptr;
+	pLastMaterial = nullptr;
 }
 
 void cpu_entity::UpdateWorld(cpu_camera* pCamera, int width, int height)
@@ -15,7 +15,16 @@ public:
 	cpu_rectangle box;
 	bool clipped;
 	byte depth;
+	byte shadingRate;
 	bool visible;
+	bool castShadow;
+	std::vector<float> bakedLight;		// per vertex (CPU_LIGHTING_BAKED), see cpu_engine::BakeLighting
+
+	// Incremental
+	ui64 lastTile;
+	cpu_mesh* pLastMesh;
+	cpu_material* pLastMaterial;
+	cpu_material lastMaterial;			// copy: a shared material can be edited in place
 
 public:
 	cpu_entity();
@@ -0,0 +1,46 @@
+#include "pch.h"
+
+cpu_entity_snapshot::cpu_entity_snapshot()
+{
+	pMesh = nullptr;
+	pTransform = nullptr;
+	pMaterial = nullptr;
+	pBakedLight = nullptr;
+	tile = 0;
+	depth = CPU_DEPTH_READ | CPU_DEPTH_WRITE;
+	shadingRate = CPU_SHADING_RATE_1X1;
+	prepass = false;
+	transparent = false;
+}
+
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+void cpu_entity_snapshot::Set(cpu_entity* pEntity, bool depthPrepass, bool copy)
+{
+	pMesh = pEntity->pMesh;
+	pTransform = &pEntity->transform;
+	pMaterial = pEntity->pMaterial;
+	if ( copy )
+	{
+		transform = *pTransform;
+		pTransform = &transform;
+		if ( pMaterial )
+		{
+			material = *pMaterial;
+			pMaterial = &material;
+		}
+	}
+	obb = pEntity->obb;
+	tile = pEntity->tile;
+	depth = pEntity->depth;
+	shadingRate = pEntity->shadingRate;
+	prepass = depthPrepass;
+	transparent = pMaterial && pMaterial->blend!=CPU_BLEND_OPAQUE;
+
+	// Baked data only changes during the preparation (cpu_engine::Render_Bake)
+	pBakedLight = nullptr;
+	if ( pMaterial && pMaterial->lighting==CPU_LIGHTING_BAKED && pMesh && pEntity->bakedLight.size()==pMesh->vertices.size() )
+		pBakedLight = pEntity->bakedLight.data();
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+// What the tile jobs read from an entity, taken at the end of the preparation. Pipelined, the transform and the
+// material are copied (the next update can run meanwhile), otherwise they point to the entity.
+// The matrices are computed before, the tile jobs only read them.
+struct cpu_entity_snapshot
+{
+public:
+	cpu_mesh* pMesh;
+	cpu_transform* pTransform;
+	cpu_material* pMaterial;
+	cpu_transform transform;
+	cpu_material material;
+	const float* pBakedLight;
+	cpu_obb obb;
+	ui64 tile;
+	byte depth;
+	byte shadingRate;
+	bool prepass;
+	bool transparent;
+
+public:
+	cpu_entity_snapshot();
+
+	void Set(cpu_entity* pEntity, bool depthPrepass, bool copy);
+};
@@ -7,25 +7,44 @@ public:
 
 	cpu_thread_job* GetThread() { return m_pThread; }
 
-	virtual void OnJob(int iTile) = 0;
+	virtual void OnRun(int iWorker, int count);
+	virtual void OnJob(int iTile) {}
 
 protected:
 	cpu_thread_job* m_pThread;
 };
 
+class cpu_job_task : public cpu_job
+{
+public:
+	void OnRun(int iWorker, int count) override;
+};
+
 class cpu_job_entity : public cpu_job
 {
 public:
 	void OnJob(int iTile) override;
 };
 
-class cpu_job_particle_physics : public cpu_job
+class cpu_job_reconstruct : public cpu_job
+{
+public:
+	void OnJob(int iTile) override;
+};
+
+class cpu_job_bake : public cpu_job
+{
+public:
+	void OnJob(int iTile) override;
+};
+
+class cpu_job_shadow : public cpu_job
 {
 public:
 	void OnJob(int iTile) override;
 };
 
-class cpu_job_particle_space : public cpu_job
+class cpu_job_post : public cpu_job
 {
 public:
 	void OnJob(int iTile) override;
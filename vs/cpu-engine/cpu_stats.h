@@ -5,6 +5,16 @@ struct cpu_stats
 public:
 	int clipEntityCount;
 	int threadCount;
+	int coreCount;
+	int logicalProcessorCount;
+	int performanceCoreCount;
+	int efficiencyCoreCount;
+	int placement;
+	int mainProcessor;					// -1: not pinned
+	std::vector<int> threadProcessors;	// logical processor of each worker (cpu_topology::processors)
 	int tileCount;
 	int drawnTriangleCount;
+	int dirtyTileCount;
+	float workTime;
+	float renderScale;
 };
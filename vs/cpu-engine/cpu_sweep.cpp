@@ -0,0 +1,12 @@
+#include "pch.h"
+
+cpu_sweep::cpu_sweep()
+{
+	threadCount = 1;
+	tileColCount = 0;
+	tileRowCount = 0;
+	frameCount = 0;
+	frameTime = 0.0f;
+	minFrameTime = 0.0f;
+	maxFrameTime = 0.0f;
+}
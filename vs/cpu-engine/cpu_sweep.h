@@ -0,0 +1,17 @@
+#pragma once
+
+// One configuration of a scaling sweep and its measured frame time (seconds, present excluded)
+struct cpu_sweep
+{
+public:
+	int threadCount;
+	int tileColCount;
+	int tileRowCount;
+	int frameCount;
+	float frameTime;
+	float minFrameTime;
+	float maxFrameTime;
+
+public:
+	cpu_sweep();
+};
@@ -1,73 +1,31 @@
 #include "pch.h"
 
-cpu_thread_job::~cpu_thread_job()
-{
-	CloseHandle(m_hEventStart);
-	CloseHandle(m_hEventEnd);
-}
-
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
-
-void cpu_thread_job::Create(int count)
+void cpu_thread_job::Create(int index, int count, cpu_barrier* pBarrier)
 {
+	m_index = index;
 	m_count = count;
-	m_hEventStart = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-	m_hEventEnd = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+	m_pBarrier = pBarrier;
+	m_generation = pBarrier->GetGeneration();
 	m_pJob = nullptr;
 	m_isWorking = false;
 }
 
 void cpu_thread_job::Stop()
 {
+	// cpu_barrier::Quit wakes all the workers first
 	QuitAsap();
-	PostStartEvent(nullptr);
 	Wait();
 }
 
-void cpu_thread_job::PostStartEvent(cpu_job* pJob)
-{
-	m_pJob = pJob;
-	SetEvent(m_hEventStart);
-}
-
-void cpu_thread_job::PostEndEvent()
-{
-	SetEvent(m_hEventEnd);
-}
-
-void cpu_thread_job::WaitStartEvent()
-{
-	WaitForSingleObject(m_hEventStart, INFINITE);
-}
-
-void cpu_thread_job::WaitEndEvent()
-{
-	WaitForSingleObject(m_hEventEnd, INFINITE);
-}
-
 void cpu_thread_job::OnCallback()
 {
-	while ( true )
+	while ( m_pBarrier->WaitPost(m_generation) )
 	{
-		WaitStartEvent();
-
-		if ( m_quitAsap )
-			break;
-
 		m_isWorking = true;
-		while ( true )
-		{
-			int index = cpuEngine.NextTile();
-			if ( index>=m_count )
-				break;
-
-			if ( m_pJob )
-				m_pJob->OnJob(index);
-		}
+		if ( m_pJob )
+			m_pJob->OnRun(m_index, m_count);
 		m_isWorking = false;
 
-		PostEndEvent();
+		m_pBarrier->Arrive();
 	}
 }
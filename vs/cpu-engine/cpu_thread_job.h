@@ -3,21 +3,17 @@
 class cpu_thread_job : public cpu_thread
 {
 public:
-	~cpu_thread_job();
-
-	void Create(int count);
+	void Create(int index, int count, cpu_barrier* pBarrier);
 	void Stop();
-	void PostStartEvent(cpu_job* pJob);
-	void PostEndEvent();
-	void WaitStartEvent();
-	void WaitEndEvent();
+	void SetJob(cpu_job* pJob) { m_pJob = pJob; }
 	bool IsWorking() { return m_isWorking; }
 	void OnCallback() override;
 
 protected:
+	int m_index;
 	int m_count;
-	HANDLE m_hEventStart;
-	HANDLE m_hEventEnd;
+	cpu_barrier* m_pBarrier;
+	ui32 m_generation;
 	cpu_job* m_pJob;
 	bool m_isWorking;
 };
@@ -8,6 +8,7 @@
 
 // Forward declarations
 struct cpu_camera;
+struct cpu_light;
 struct cpu_ps_io;
 
 // Types
@@ -17,6 +18,10 @@ using CPU_PS_FUNC						= void(*)(cpu_ps_io& data);
 #define CPU_LIGHTING_UNLIT				0
 #define CPU_LIGHTING_GOURAUD			1
 #define CPU_LIGHTING_LAMBERT			2
+#define CPU_LIGHTING_BAKED				3
+#define CPU_LIGHT_DIRECTIONAL			0
+#define CPU_LIGHT_POINT					1
+#define CPU_LIGHT_SPOT					2
 
 // Text
 #define CPU_TEXT_LEFT					0
@@ -33,6 +38,38 @@ using CPU_PS_FUNC						= void(*)(cpu_ps_io& data);
 #define CPU_DEPTH_READ					1
 #define CPU_DEPTH_WRITE					2
 #define CPU_DEPTH_RW					4
+#define CPU_DEPTH_EQUAL					8
+#define CPU_DEPTH_EQUAL_EPSILON			0.00001f
+#define CPU_DEPTH_FORMAT_F32			0
+#define CPU_DEPTH_FORMAT_U16			1
+#define CPU_DEPTH_FORMAT_F32_REVERSED	2
+
+// Blend (transparent materials are drawn after the opaque ones, back to front, without depth write)
+#define CPU_BLEND_OPAQUE				0
+#define CPU_BLEND_ALPHA					1
+#define CPU_BLEND_ADD					2
+#define CPU_BLEND_PREMULTIPLIED			3
+
+// Shading rate (pixel block width x height)
+#define CPU_SHADING_RATE_1X1			0
+#define CPU_SHADING_RATE_1X2			1
+#define CPU_SHADING_RATE_2X2			2
+#define CPU_SHADING_RATE_4X4			3
+#define CPU_SHADING_CONTRAST_1X2		6.0f
+#define CPU_SHADING_CONTRAST_2X2		3.0f
+
+// Shadow
+#define CPU_SHADOW_SIZE					1024
+#define CPU_SHADOW_BIAS					0.002f
+
+// Checkerboard
+#define CPU_CHECKERBOARD_TOLERANCE		0.05f
+
+// Effect
+#define CPU_EFFECT_TINT					0
+#define CPU_EFFECT_AMIGA				1
+#define CPU_EFFECT_BLUR					2
+#define CPU_EFFECT_BLEND				3
 
 // Particle
 #define CPU_PARTICLE_INTENSITY			0
@@ -56,4 +93,6 @@ using CPU_PS_FUNC						= void(*)(cpu_ps_io& data);
 #include "cpu_ps_io.h"
 #include "cpu_draw.h"
 #include "cpu_rt.h"
+#include "cpu_depth.h"
+#include "cpu_effect.h"
 #include "cpu_device.h"
@@ -9,6 +9,7 @@ cpu_camera::cpu_camera()
 	aspectRatio = width/height;
 	near = 0.1f;
 	far = 100.0f;
+	reversedZ = false;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -17,10 +18,12 @@ cpu_camera::cpu_camera()
 
 void cpu_camera::UpdateProjection()
 {
+	float zNear = reversedZ ? far : near;
+	float zFar = reversedZ ? near : far;
 	if ( perspective )
-		XMStoreFloat4x4(&matProj, XMMatrixPerspectiveFovLH(fov, aspectRatio, near, far));
+		XMStoreFloat4x4(&matProj, XMMatrixPerspectiveFovLH(fov, aspectRatio, zNear, zFar));
 	else
-		XMStoreFloat4x4(&matProj, XMMatrixOrthographicLH(width, height, near, far));
+		XMStoreFloat4x4(&matProj, XMMatrixOrthographicLH(width, height, zNear, zFar));
 }
 
 void cpu_camera::Update()
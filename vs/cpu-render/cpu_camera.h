@@ -10,6 +10,7 @@ public:
 	float height;				// ortho
 	float near;
 	float far;
+	bool reversedZ;				// near maps to 1, far to 0
 	XMFLOAT4X4 matView;
 	XMFLOAT4X4 matProj;
 	XMFLOAT4X4 matViewProj;
@@ -0,0 +1,48 @@
+#pragma once
+
+// Depth formats: storage, clear value, comparison (nearer, equal after a prepass) and conversion from the NDC depth
+
+struct cpu_depth_f32
+{
+public:
+	using type = float;
+	static constexpr bool reversed = false;
+	static constexpr float clear = 1.0f;
+
+public:
+	static type* Buffer(cpu_rt& rt) { return rt.depthBuffer.data(); }
+	static type Encode(float z) { return z; }
+	static float Decode(type v) { return v; }
+	static bool Test(type z, type stored) { return z<stored; }
+	static bool Equal(type z, type stored) { return z<=stored+CPU_DEPTH_EQUAL_EPSILON; }
+};
+
+struct cpu_depth_u16
+{
+public:
+	using type = ui16;
+	static constexpr bool reversed = false;
+	static constexpr ui16 clear = 0xFFFF;
+
+public:
+	static type* Buffer(cpu_rt& rt) { return rt.depthBuffer16.data(); }
+	static type Encode(float z) { return (ui16)std::min(z * 65535.0f + 0.5f, 65535.0f); }
+	static float Decode(type v) { return v * (1.0f/65535.0f); }
+	static bool Test(type z, type stored) { return z<stored; }
+	static bool Equal(type z, type stored) { return z<=stored+1; }
+};
+
+struct cpu_depth_f32_reversed
+{
+public:
+	using type = float;
+	static constexpr bool reversed = true;
+	static constexpr float clear = 0.0f;
+
+public:
+	static type* Buffer(cpu_rt& rt) { return rt.depthBuffer.data(); }
+	static type Encode(float z) { return z; }
+	static float Decode(type v) { return v; }
+	static bool Test(type z, type stored) { return z>stored; }
+	static bool Equal(type z, type stored) { return z>=stored-CPU_DEPTH_EQUAL_EPSILON; }
+};
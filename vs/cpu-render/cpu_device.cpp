@@ -3,6 +3,8 @@
 cpu_device::cpu_device()
 {
 	m_created = false;
+	m_checkerboard = -1;
+	m_pShadowMap = nullptr;
 
 #ifdef CPU_CONFIG_GPU
 	m_pD2DFactory = nullptr;
@@ -41,15 +43,7 @@ bool cpu_device::Create(cpu_window* pWindow, int width, int height)
 
 	// Buffer
 	m_pRT = &m_mainRT;
-	m_mainRT.width = m_width;
-	m_mainRT.height = height;
-	m_mainRT.aspectRatio = float(m_width)/float(m_height);
-	m_mainRT.pixelCount = m_width * m_height;
-	m_mainRT.widthHalf = m_width * 0.5f;
-	m_mainRT.heightHalf = m_height * 0.5f;
-	m_mainRT.colorBuffer.resize(m_mainRT.pixelCount);
-	m_mainRT.depth = true;
-	m_mainRT.depthBuffer.resize(m_mainRT.pixelCount);
+	m_mainRT.Create(m_width, m_height, true);
 
 	// Surface
 #ifdef CPU_CONFIG_GPU
@@ -94,6 +88,24 @@ void cpu_device::Destroy()
 	m_pWindow = nullptr;
 }
 
+bool cpu_device::Resize(int width, int height)
+{
+	width = cpu::Clamp(width, 1, m_width);
+	height = cpu::Clamp(height, 1, m_height);
+	if ( width==m_mainRT.width && height==m_mainRT.height )
+		return false;
+
+	// Buffer (allocated at full size, no reallocation)
+	m_mainRT.Create(width, height, m_mainRT.depth, m_mainRT.depthFormat);
+
+	// Surface (the bitmap keeps the full size, Present copies a sub-rectangle)
+#ifndef CPU_CONFIG_GPU
+	m_bi.bmiHeader.biWidth = width;
+	m_bi.bmiHeader.biHeight = -height;
+#endif
+	return true;
+}
+
 void cpu_device::Fix()
 {
 #ifdef CPU_CONFIG_GPU
@@ -125,8 +137,17 @@ void cpu_device::SetCamera(cpu_camera* pCamera)
 
 void cpu_device::UpdateCamera()
 {
-	if ( m_pCamera )
-		m_pCamera->Update();
+	if ( m_pCamera==nullptr )
+		return;
+
+	// Reversed-Z: the projection follows the depth format of the main render target
+	bool reversedZ = m_mainRT.depthFormat==CPU_DEPTH_FORMAT_F32_REVERSED;
+	if ( m_pCamera->reversedZ!=reversedZ )
+	{
+		m_pCamera->reversedZ = reversedZ;
+		m_pCamera->UpdateProjection();
+	}
+	m_pCamera->Update();
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -143,6 +164,29 @@ void cpu_device::SetLight(cpu_light* pLight)
 	m_pLight = pLight;
 }
 
+void cpu_device::SetShadowMap(cpu_rt* pShadowMap, XMFLOAT4X4* pMatrix)
+{
+	m_pShadowMap = pShadowMap && pShadowMap->depth && pMatrix ? pShadowMap : nullptr;
+	if ( m_pShadowMap )
+		m_shadowMatrix = *pMatrix;
+}
+
+float cpu_device::GetShadow(XMFLOAT3& pos)
+{
+	if ( m_pShadowMap==nullptr )
+		return 1.0f;
+
+	// Orthographic light: no divide
+	XMVECTOR p = XMVector3TransformCoord(XMLoadFloat3(&pos), XMLoadFloat4x4(&m_shadowMatrix));
+	int x = (int)XMVectorGetX(p);
+	int y = (int)XMVectorGetY(p);
+	if ( x<0 || y<0 || x>=m_pShadowMap->width || y>=m_pShadowMap->height )
+		return 1.0f;
+
+	float stored = m_pShadowMap->GetDepth(y * m_pShadowMap->width + x);
+	return XMVectorGetZ(p)-m_pLight->shadowBias>stored ? 0.0f : 1.0f;
+}
+
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -179,8 +223,30 @@ void cpu_device::CopyDepth(cpu_rt* pRT)
 		return;
 
 	cpu_rt& rt = *GetRT();
-	if ( pRT->depth && rt.depth )
+	if ( pRT->depth==false || rt.depth==false )
+		return;
+
+	if ( pRT->depthFormat==rt.depthFormat && pRT->pixelCount==rt.pixelCount )
+	{
 		rt.depthBuffer = pRT->depthBuffer;
+		rt.depthBuffer16 = pRT->depthBuffer16;
+		return;
+	}
+
+	// Different formats: conversion through the normalized depth
+	int count = std::min(rt.pixelCount, pRT->pixelCount);
+	for ( int i=0 ; i<count ; i++ )
+		rt.SetDepth(i, pRT->GetDepth(i));
+}
+
+void cpu_device::SetDepthFormat(int format)
+{
+	if ( m_mainRT.depthFormat==format )
+		return;
+
+	m_mainRT.Create(m_mainRT.width, m_mainRT.height, true, format);
+	ClearDepth();
+	UpdateCamera();
 }
 
 void cpu_device::AlphaBlend(cpu_rt* pRT)
@@ -192,10 +258,18 @@ void cpu_device::AlphaBlend(cpu_rt* pRT)
 	cpu_img32::AlphaBlend((byte*)pRT->colorBuffer.data(), pRT->width, pRT->height, (byte*)rt.colorBuffer.data(), rt.width, rt.height, 0, 0, 0, 0, rt.width, rt.height); 
 }
 
-void cpu_device::ToAmigaStyle()
+void cpu_device::ToAmigaStyle(cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
-	cpu_img32::ToAmigaPalette((byte*)rt.colorBuffer.data(), rt.width, rt.height); 
+	if ( pTile==nullptr )
+	{
+		cpu_img32::ToAmigaPalette((byte*)rt.colorBuffer.data(), rt.width, rt.height);
+		return;
+	}
+
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	cpu_img32::ToAmigaPalette((byte*)rt.colorBuffer.data(), rt.width, rt.height, rc.minX, rc.minY, rc.maxX-rc.minX, rc.maxY-rc.minY);
 }
 
 void cpu_device::Blur(int radius)
@@ -204,34 +278,410 @@ void cpu_device::Blur(int radius)
 		return;
 
 	cpu_rt& rt = *GetRT();
-	cpu_img32::Blur((byte*)rt.colorBuffer.data(), rt.width, rt.height, radius);
+	cpu_img32::GaussianBlur((byte*)rt.colorBuffer.data(), rt.width, rt.height, radius);
+}
+
+void cpu_device::Reconstruct(cpu_rt* pHistory, cpu_rt* pOutHistory, XMFLOAT4X4& prevViewProj, XMFLOAT4X4& invViewProj, cpu_tile* pTile)
+{
+	cpu_rt& rt = *GetRT();
+	if ( m_checkerboard<0 || rt.depth==false )
+		return;
+
+	switch ( rt.depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		ReconstructTile<cpu_depth_u16>(pHistory, pOutHistory, prevViewProj, invViewProj, pTile);
+		break;
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		ReconstructTile<cpu_depth_f32_reversed>(pHistory, pOutHistory, prevViewProj, invViewProj, pTile);
+		break;
+	default:
+		ReconstructTile<cpu_depth_f32>(pHistory, pOutHistory, prevViewProj, invViewProj, pTile);
+		break;
+	}
+}
+
+template <typename D>
+void cpu_device::ReconstructTile(cpu_rt* pHistory, cpu_rt* pOutHistory, XMFLOAT4X4& prevViewProj, XMFLOAT4X4& invViewProj, cpu_tile* pTile)
+{
+	cpu_rt& rt = *GetRT();
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	ui32* color = rt.colorBuffer.data();
+	typename D::type* depth = D::Buffer(rt);
+	bool useHistory = pHistory && pHistory->depth && pHistory->depthFormat==rt.depthFormat && pHistory->width==rt.width && pHistory->height==rt.height;
+	XMMATRIX matPrev = XMLoadFloat4x4(&prevViewProj);
+	XMMATRIX matInv = XMLoadFloat4x4(&invViewProj);
+
+	for ( int y=rc.minY ; y<rc.maxY ; y++ )
+	{
+		// First missing pixel of the row
+		int x0 = rc.minX;
+		if ( ((rc.minX+y+m_checkerboard) & 1)==0 )
+			x0++;
+
+		for ( int x=x0 ; x<rc.maxX ; x+=2 )
+		{
+			// Already written by a full rate draw
+			int index = y * rt.width + x;
+			if ( depth[index]!=D::clear )
+				continue;
+
+			// Neighbors (shaded this frame)
+			int n[4];
+			int count = 0;
+			if ( x>0 )
+				n[count++] = index - 1;
+			if ( x<rt.width-1 )
+				n[count++] = index + 1;
+			if ( y>0 )
+				n[count++] = index - rt.width;
+			if ( y<rt.height-1 )
+				n[count++] = index + rt.width;
+
+			// Depth: nearest neighbor surface, background keeps the clear color
+			typename D::type zNearest = D::clear;
+			for ( int i=0 ; i<count ; i++ )
+			{
+				if ( D::Test(depth[n[i]], zNearest) )
+					zNearest = depth[n[i]];
+			}
+			if ( zNearest==D::clear )
+				continue;
+			float z = D::Decode(zNearest);
+
+			// Neighborhood: average and bounds
+			int sum[3] = { 0, 0, 0 };
+			int lo[3] = { 255, 255, 255 };
+			int hi[3] = { 0, 0, 0 };
+			for ( int i=0 ; i<count ; i++ )
+			{
+				ui32 c = color[n[i]];
+				for ( int k=0 ; k<3 ; k++ )
+				{
+					int v = (c >> (k*8)) & 0xFF;
+					sum[k] += v;
+					lo[k] = std::min(lo[k], v);
+					hi[k] = std::max(hi[k], v);
+				}
+			}
+			ui32 out = 0xFF000000 | ((sum[2]/count) << 16) | ((sum[1]/count) << 8) | (sum[0]/count);
+
+			// Reprojection
+			if ( useHistory )
+			{
+				float ndcX = (x + 0.5f) / rt.widthHalf - 1.0f;
+				float ndcY = 1.0f - (y + 0.5f) / rt.heightHalf;
+				XMVECTOR world = XMVector4Transform(XMVectorSet(ndcX, ndcY, z, 1.0f), matInv);
+				world = XMVectorDivide(world, XMVectorSplatW(world));
+				XMFLOAT4 clip;
+				XMStoreFloat4(&clip, XMVector4Transform(world, matPrev));
+				if ( clip.w>CPU_EPSILON )
+				{
+					float invW = 1.0f / clip.w;
+					float px = (clip.x * invW + 1.0f) * rt.widthHalf;
+					float py = (1.0f - clip.y * invW) * rt.heightHalf;
+					float pz = clip.z * invW;
+					if ( px>=0.0f && px<(float)rt.width && py>=0.0f && py<(float)rt.height )
+					{
+						// Disocclusion: the history surface must match the reprojected depth
+						int prevIndex = (int)py * rt.width + (int)px;
+						float historyZ = D::Decode(D::Buffer(*pHistory)[prevIndex]);
+						float range = D::reversed ? pz : 1.0f-pz;
+						if ( fabsf(historyZ-pz)<=CPU_CHECKERBOARD_TOLERANCE*range+CPU_EPSILON )
+						{
+							// Clamp to the neighborhood to avoid ghosting
+							ui32 c = pHistory->colorBuffer[prevIndex];
+							out = 0xFF000000;
+							for ( int k=0 ; k<3 ; k++ )
+							{
+								int v = cpu::Clamp((int)((c >> (k*8)) & 0xFF), lo[k], hi[k]);
+								out |= v << (k*8);
+							}
+						}
+					}
+				}
+			}
+
+			color[index] = out;
+			depth[index] = zNearest;
+		}
+	}
+
+	// History
+	if ( pOutHistory==nullptr || pOutHistory->width!=rt.width || pOutHistory->height!=rt.height )
+		return;
+	for ( int y=rc.minY ; y<rc.maxY ; y++ )
+	{
+		int offset = y * rt.width + rc.minX;
+		int count = rc.maxX - rc.minX;
+		memcpy(pOutHistory->colorBuffer.data()+offset, color+offset, count*sizeof(ui32));
+		if ( pOutHistory->depth && pOutHistory->depthFormat==rt.depthFormat )
+			memcpy(D::Buffer(*pOutHistory)+offset, depth+offset, count*sizeof(typename D::type));
+	}
+}
+
+void cpu_device::AddTint(XMFLOAT3& color, float amount)
+{
+	cpu_effect effect;
+	effect.type = CPU_EFFECT_TINT;
+	effect.color.x = cpu::Clamp(color.x);
+	effect.color.y = cpu::Clamp(color.y);
+	effect.color.z = cpu::Clamp(color.z);
+	effect.amount = cpu::Clamp(amount);
+	m_effects.push_back(effect);
+}
+
+void cpu_device::AddAmigaStyle()
+{
+	cpu_effect effect;
+	effect.type = CPU_EFFECT_AMIGA;
+	m_effects.push_back(effect);
+}
+
+void cpu_device::AddBlur(int radius)
+{
+	if ( radius<1 )
+		return;
+
+	cpu_effect effect;
+	effect.type = CPU_EFFECT_BLUR;
+	effect.radius = std::min(radius, 254);
+	m_effects.push_back(effect);
+}
+
+void cpu_device::AddBlend(cpu_rt* pRT)
+{
+	if ( pRT==nullptr )
+		return;
+
+	cpu_effect effect;
+	effect.type = CPU_EFFECT_BLEND;
+	effect.pRT = pRT;
+	m_effects.push_back(effect);
+}
+
+int cpu_device::GetEffectHalo()
+{
+	// Each blur widens the region the following effects depend on
+	int halo = 0;
+	for ( cpu_effect& effect : m_effects )
+	{
+		if ( effect.type==CPU_EFFECT_BLUR )
+			halo += effect.radius;
+	}
+	return halo;
+}
+
+void cpu_device::ApplyEffects(cpu_tile* pTile)
+{
+	if ( m_effects.size()==0 )
+		return;
+
+	cpu_rt& rt = *GetRT();
+	int halo = GetEffectHalo();
+	if ( halo )
+		m_effectBuffer.resize(rt.pixelCount);
+
+	// Region: tile and halo, on even coordinates to keep the Amiga dither pattern
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	int minX = std::max(0, rc.minX-halo) & ~1;
+	int minY = std::max(0, rc.minY-halo) & ~1;
+	int maxX = std::min(rt.width, rc.maxX+halo);
+	int maxY = std::min(rt.height, rc.maxY+halo);
+	int w = maxX - minX;
+	int h = maxY - minY;
+	if ( w<=0 || h<=0 )
+		return;
+
+	// Scratch of the worker: one read of the frame
+	static thread_local std::vector<ui32> s_scratch[2];
+	static thread_local std::vector<int> s_sums;
+	s_scratch[0].resize((size_t)w * h);
+	ui32* src = s_scratch[0].data();
+	for ( int y=0 ; y<h ; y++ )
+		memcpy(src + y*w, rt.colorBuffer.data() + (minY+y)*rt.width + minX, w*sizeof(ui32));
+
+	for ( cpu_effect& effect : m_effects )
+	{
+		switch ( effect.type )
+		{
+		case CPU_EFFECT_TINT:
+		{
+			// c * lerp(1, color, amount), 8.8 fixed point
+			int fb = (int)((1.0f - effect.amount + effect.amount * effect.color.z) * 256.0f);
+			int fg = (int)((1.0f - effect.amount + effect.amount * effect.color.y) * 256.0f);
+			int fr = (int)((1.0f - effect.amount + effect.amount * effect.color.x) * 256.0f);
+			const __m128i factor = _mm_setr_epi16((short)fb, (short)fg, (short)fr, 256, (short)fb, (short)fg, (short)fr, 256);
+			const __m128i zero = _mm_setzero_si128();
+			int count = w * h;
+			int i = 0;
+			for ( ; i+4<=count ; i+=4 )
+			{
+				__m128i px = _mm_loadu_si128((const __m128i*)(src + i));
+				__m128i lo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(px, zero), factor), 8);
+				__m128i hi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(px, zero), factor), 8);
+				_mm_storeu_si128((__m128i*)(src + i), _mm_packus_epi16(lo, hi));
+			}
+			for ( ; i<count ; i++ )
+			{
+				ui32 c = src[i];
+				ui32 b = std::min(255u, ((c & 0xFF) * fb) >> 8);
+				ui32 g = std::min(255u, (((c >> 8) & 0xFF) * fg) >> 8);
+				ui32 r = std::min(255u, (((c >> 16) & 0xFF) * fr) >> 8);
+				src[i] = (c & 0xFF000000) | (r << 16) | (g << 8) | b;
+			}
+			break;
+		}
+		case CPU_EFFECT_AMIGA:
+			cpu_img32::ToAmigaPalette((byte*)src, w, h);
+			break;
+		case CPU_EFFECT_BLUR:
+			// Edges of the scratch are clamped: only the halo is affected
+			s_scratch[1].resize((size_t)w * h);
+			s_sums.resize((size_t)w * 4);
+			cpu_img32::GaussianBlurRows((byte*)src, (byte*)s_scratch[1].data(), w, h, effect.radius, 0, h);
+			cpu_img32::GaussianBlurCols((byte*)src, (byte*)s_scratch[1].data(), w, h, effect.radius, 0, w, s_sums.data());
+			break;
+		case CPU_EFFECT_BLEND:
+			if ( effect.pRT->width==rt.width && effect.pRT->height==rt.height )
+				cpu_img32::AlphaBlend((byte*)effect.pRT->colorBuffer.data(), rt.width, rt.height, (byte*)src, w, h, minX, minY, 0, 0, w, h);
+			break;
+		}
+	}
+
+	// One write of the tile (second buffer when the neighbors still read this tile as their halo)
+	ui32* dst = halo ? m_effectBuffer.data() : rt.colorBuffer.data();
+	for ( int y=rc.minY ; y<rc.maxY ; y++ )
+		memcpy(dst + y*rt.width + rc.minX, src + (y-minY)*w + rc.minX-minX, (rc.maxX-rc.minX)*sizeof(ui32));
+
+	if ( pTile==nullptr )
+		ResolveEffects();
+}
+
+void cpu_device::ResolveEffects()
+{
+	if ( GetEffectHalo()==0 )
+		return;
+
+	cpu_rt& rt = *GetRT();
+	if ( m_effectBuffer.size()==rt.colorBuffer.size() )
+		rt.colorBuffer.swap(m_effectBuffer);
+}
+
+int cpu_device::EstimateShadingRate(cpu_tile* pTile)
+{
+	// Luminance difference between samples 4 pixels apart (across coarse blocks)
+	cpu_rt& rt = *GetRT();
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	const ui32* color = rt.colorBuffer.data();
+	int sum = 0;
+	int count = 0;
+	for ( int y=rc.minY ; y+4<rc.maxY ; y+=4 )
+	{
+		int x0 = rc.minX;
+		if ( m_checkerboard>=0 && ((x0+y+m_checkerboard) & 1) )
+			x0++;
+
+		for ( int x=x0 ; x+4<rc.maxX ; x+=4 )
+		{
+			int index = y * rt.width + x;
+			int l = cpu::ToLuminance(color[index]);
+			sum += abs(l - cpu::ToLuminance(color[index+4]));
+			sum += abs(l - cpu::ToLuminance(color[index+4*rt.width]));
+			count += 2;
+		}
+	}
+	if ( count==0 )
+		return CPU_SHADING_RATE_1X1;
+
+	float contrast = (float)sum / (float)count;
+	if ( contrast<CPU_SHADING_CONTRAST_2X2 )
+		return CPU_SHADING_RATE_2X2;
+	if ( contrast<CPU_SHADING_CONTRAST_1X2 )
+		return CPU_SHADING_RATE_1X2;
+	return CPU_SHADING_RATE_1X1;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void cpu_device::ClearColor()
+void cpu_device::ClearColor(cpu_tile* pTile)
+{
+	FillColor(0, pTile);
+}
+
+void cpu_device::ClearColor(XMFLOAT3& rgb, cpu_tile* pTile)
+{
+	FillColor(cpu::ToBGR(rgb), pTile);
+}
+
+void cpu_device::FillColor(ui32 bgr, cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
-	std::fill(rt.colorBuffer.begin(), rt.colorBuffer.end(), 0);
+	if ( pTile==nullptr )
+	{
+		std::fill(rt.colorBuffer.begin(), rt.colorBuffer.end(), bgr);
+		return;
+	}
+
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	for ( int y=rc.minY ; y<rc.maxY ; y++ )
+	{
+		ui32* row = rt.colorBuffer.data() + y * rt.width;
+		std::fill(row + rc.minX, row + rc.maxX, bgr);
+	}
 }
 
-void cpu_device::ClearColor(XMFLOAT3& rgb)
+void cpu_device::ClearDepth(cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
-	std::fill(rt.colorBuffer.begin(), rt.colorBuffer.end(), cpu::ToBGR(rgb));
+	if ( rt.depth==false )
+		return;
+
+	switch ( rt.depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		FillDepth<cpu_depth_u16>(pTile);
+		break;
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		FillDepth<cpu_depth_f32_reversed>(pTile);
+		break;
+	default:
+		FillDepth<cpu_depth_f32>(pTile);
+		break;
+	}
 }
 
-void cpu_device::ClearDepth()
+template <typename D>
+void cpu_device::FillDepth(cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
-	std::fill(rt.depthBuffer.begin(), rt.depthBuffer.end(), 1.0f);
+	typename D::type* depth = D::Buffer(rt);
+	if ( pTile==nullptr )
+	{
+		std::fill(depth, depth + rt.pixelCount, D::clear);
+		return;
+	}
+
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	for ( int y=rc.minY ; y<rc.maxY ; y++ )
+	{
+		typename D::type* row = depth + y * rt.width;
+		std::fill(row + rc.minX, row + rc.maxX, D::clear);
+	}
 }
 
-void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
+void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor, cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
 
 	ui32 gCol = cpu::ToBGR(groundColor);
 	ui32 sCol = cpu::ToBGR(skyColor);
@@ -258,32 +708,33 @@ void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
 
 	if ( fabsf(a)<0.000001f )
 	{
-		for ( int y=0 ; y<rt.height ; y++ )
+		for ( int y=rc.minY ; y<rc.maxY ; y++ )
 		{
 			float val = b * (float)y + c;
 			ui32 col = val>0.0f ? sCol : gCol;
-			std::fill(rt.colorBuffer.begin() + (y * rt.width),  rt.colorBuffer.begin() + ((y + 1) * rt.width), col);
+			ui32* rowPtr = rt.colorBuffer.data() + (y * rt.width);
+			std::fill(rowPtr + rc.minX, rowPtr + rc.maxX, col);
 		}
 	}
 	else
 	{
 		float invA = -1.0f / a;
-		for ( int y=0 ; y<rt.height ; y++ )
+		for ( int y=rc.minY ; y<rc.maxY ; y++ )
 		{
 			float fSplitX = (b * (float)y + c) * invA;
 			int splitX;
-			if ( fSplitX<0.0f )
-				splitX = 0;
-			else if ( fSplitX>(float)rt.width)
-				splitX = rt.width;
+			if ( fSplitX<(float)rc.minX )
+				splitX = rc.minX;
+			else if ( fSplitX>(float)rc.maxX )
+				splitX = rc.maxX;
 			else
 				splitX = (int)fSplitX;
 
 			ui32* rowPtr = rt.colorBuffer.data() + (y * rt.width);
-			if ( splitX>0 )
-				std::fill(rowPtr, rowPtr + splitX, colLeft);
-			if ( splitX<rt.width )
-				std::fill(rowPtr + splitX, rowPtr + rt.width, colRight);
+			if ( splitX>rc.minX )
+				std::fill(rowPtr + rc.minX, rowPtr + splitX, colLeft);
+			if ( splitX<rc.maxX )
+				std::fill(rowPtr + splitX, rowPtr + rc.maxX, colRight);
 		}
 	}
 
@@ -304,7 +755,7 @@ void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
 
 	if ( fabsf(a)<CPU_EPSILON )
 	{
-		for ( int y=0 ; y<rt.height ; ++y )
+		for ( int y=rc.minY ; y<rc.maxY ; ++y )
 		{
 			float distPx = (b * (float)y + c) * invGrad;
 			if ( fabsf(distPx)>bandPx )
@@ -313,12 +764,12 @@ void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
 			t = t * t * (3.0f - 2.0f * t); // optional
 			ui32 col = cpu::LerpColor(gCol, sCol, t);
 			ui32* row = rt.colorBuffer.data() + y * rt.width;
-			std::fill(row, row + rt.width, col);
+			std::fill(row + rc.minX, row + rc.maxX, col);
 		}
 		return;
 	}
 
-	for ( int y=0 ; y<rt.height ; ++y )
+	for ( int y=rc.minY ; y<rc.maxY ; ++y )
 	{
 		ui32* row = rt.colorBuffer.data() + y * rt.width;
 		float byc = b * (float)y + c;
@@ -328,12 +779,12 @@ void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
 		float xMaxF = (xA > xB) ? xA : xB;
 		int x0 = cpu::FloorToInt(xMinF);
 		int x1 = cpu::CeilToInt(xMaxF);
-		if ( x1<0 || x0>=rt.width )
+		if ( x1<rc.minX || x0>=rc.maxX )
 			continue;
-		if ( x0<0 )
-			x0 = 0;
-		if ( x1>=rt.width)
-			x1 = rt.width - 1;
+		if ( x0<rc.minX )
+			x0 = rc.minX;
+		if ( x1>=rc.maxX )
+			x1 = rc.maxX - 1;
 		float val = byc + a * (float)x0;
 		ui32* p = row + x0;
 		ui32* e = row + x1 + 1;
@@ -352,7 +803,7 @@ void cpu_device::ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor)
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void cpu_device::DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_material* pMaterial, int depthMode, cpu_tile* pTile)
+void cpu_device::DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_material* pMaterial, int depthMode, cpu_tile* pTile, int shadingRate, const float* pBakedLight)
 {
 	cpu_rt& rt = *GetRT();
 	cpu_material& material = pMaterial ? *pMaterial : m_defaultMaterial;
@@ -365,6 +816,17 @@ void cpu_device::DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_materi
 	draw.pMaterial = &material;
 	draw.pTile = pTile;
 	draw.depth = depthMode;
+	draw.shadingRate = (byte)std::max(shadingRate, (int)material.shadingRate);
+	draw.blend = material.blend;
+	if ( pTile )
+		draw.shadingRate = std::max(draw.shadingRate, pTile->shadingRate);
+
+	// Rasterizer for the depth format
+	void (cpu_device::*drawTriangle)(cpu_draw&) = &cpu_device::DrawTriangle<cpu_depth_f32>;
+	if ( rt.depthFormat==CPU_DEPTH_FORMAT_U16 )
+		drawTriangle = &cpu_device::DrawTriangle<cpu_depth_u16>;
+	else if ( rt.depthFormat==CPU_DEPTH_FORMAT_F32_REVERSED )
+		drawTriangle = &cpu_device::DrawTriangle<cpu_depth_f32_reversed>;
 
 	cpu_vertex_out vo[3];
 	cpu_vertex_out clipped[8];
@@ -398,10 +860,15 @@ void cpu_device::DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_materi
 			vo[i].albedo.y = cpu::Clamp(in.color.y * material.color.y);
 			vo[i].albedo.z = cpu::Clamp(in.color.z * material.color.z);
 
-			// Intensity
-			float ndotl = XMVectorGetX(XMVector3Dot(worldNormal, lightDir));
-			ndotl = std::max(0.0f, ndotl);
-			vo[i].intensity = ndotl + m_pLight->ambient;
+			// Intensity (baked: one value per vertex, no lighting math)
+			if ( pBakedLight )
+				vo[i].intensity = pBakedLight[offset+i];
+			else
+			{
+				float ndotl = XMVectorGetX(XMVector3Dot(worldNormal, lightDir));
+				ndotl = std::max(0.0f, ndotl);
+				vo[i].intensity = ndotl + m_pLight->ambient;
+			}
 
 			// UV
 			vo[i].uv.x = in.uv.x * invW;
@@ -420,46 +887,109 @@ void cpu_device::DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_materi
 			draw.vo[1] = &clipped[i];
 			draw.vo[2] = &clipped[i+1];
 			if ( ClipToScreen(draw) )
-				DrawTriangle(draw);
+				(this->*drawTriangle)(draw);
 		}
 	}
 }
 
-void cpu_device::DrawWireframeMesh(cpu_mesh* pMesh, FXMMATRIX matrix, cpu_tile* pTile)
+void cpu_device::DrawMeshDepth(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_tile* pTile)
 {
+	// Position only: no lighting, no attributes, no pixel shader
 	cpu_rt& rt = *GetRT();
+	if ( rt.depth==false )
+		return;
+
+	XMMATRIX matWorld = XMLoadFloat4x4(&pTransform->GetWorld());
 	XMMATRIX matViewProj = XMLoadFloat4x4(&m_pCamera->matViewProj);
 
-	XMFLOAT4 clip[3];
+	cpu_draw draw;
+	draw.pMaterial = &m_defaultMaterial;
+	draw.pTile = pTile;
+	draw.depth = CPU_DEPTH_READ | CPU_DEPTH_WRITE;
+	draw.shadingRate = CPU_SHADING_RATE_1X1;
+	draw.blend = CPU_BLEND_OPAQUE;
+
+	// Rasterizer for the depth format
+	void (cpu_device::*drawTriangle)(cpu_draw&) = &cpu_device::DrawTriangleDepth<cpu_depth_f32>;
+	if ( rt.depthFormat==CPU_DEPTH_FORMAT_U16 )
+		drawTriangle = &cpu_device::DrawTriangleDepth<cpu_depth_u16>;
+	else if ( rt.depthFormat==CPU_DEPTH_FORMAT_F32_REVERSED )
+		drawTriangle = &cpu_device::DrawTriangleDepth<cpu_depth_f32_reversed>;
+
+	// Same transform as DrawMesh (world then view-projection): equal depth values
+	cpu_vertex_out vo[3] = {};
+	cpu_vertex_out clipped[8] = {};
 	for ( size_t offset=0 ; offset<pMesh->vertices.size() ; offset+=3 )
 	{
+		bool inside = true;
 		for ( int i=0 ; i<3 ; ++i )
 		{
-			const cpu_vertex& in = pMesh->vertices[offset+i];
-			XMVECTOR loc = XMLoadFloat3(&in.pos);
-			loc = XMVectorSetW(loc, 1.0f);
-			XMVECTOR world = XMVector4Transform(loc, matrix);
-			XMVECTOR c = XMVector4Transform(world, matViewProj);
-			XMStoreFloat4(&clip[i], c);
+			XMVECTOR loc = XMVectorSetW(XMLoadFloat3(&pMesh->vertices[offset+i].pos), 1.0f);
+			XMVECTOR clip = XMVector4Transform(XMVector4Transform(loc, matWorld), matViewProj);
+			XMStoreFloat4(&vo[i].clipPos, clip);
+			const XMFLOAT4& c = vo[i].clipPos;
+			if ( c.x<-c.w || c.x>c.w || c.y<-c.w || c.y>c.w || c.z<0.0f || c.z>c.w )
+				inside = false;
 		}
-		
-		const int edges[3][2] = { {0,1}, {1,2}, {2,0} };
-		for ( int e=0 ; e<3 ; ++e )
+
+		// Clipping (rare, interpolates unused attributes)
+		if ( inside )
 		{
-			XMFLOAT4 a = clip[edges[e][0]];
-			XMFLOAT4 b = clip[edges[e][1]];
-			if ( WireframeClipLineNearPlane(a, b)==false )
-				continue;
+			draw.vo[0] = &vo[0];
+			draw.vo[1] = &vo[1];
+			draw.vo[2] = &vo[2];
+			if ( ClipToScreen(draw) )
+				(this->*drawTriangle)(draw);
+			continue;
+		}
+		int count = ClipTriangleFrustum(vo, clipped);
+		for ( int i=1 ; i+1<count ; ++i )
+		{
+			draw.vo[0] = &clipped[0];
+			draw.vo[1] = &clipped[i];
+			draw.vo[2] = &clipped[i+1];
+			if ( ClipToScreen(draw) )
+				(this->*drawTriangle)(draw);
+		}
+	}
+}
 
-			XMFLOAT3 sa, sb;
-			if ( WireframeClipToScreen(a, rt.widthHalf, rt.heightHalf, sa)==false )
-				continue;
-			if ( WireframeClipToScreen(b, rt.widthHalf, rt.heightHalf, sb)==false )
-				continue;
+void cpu_device::DrawWireframeMesh(cpu_mesh* pMesh, FXMMATRIX matrix, cpu_tile* pTile)
+{
+	cpu_rt& rt = *GetRT();
+	XMMATRIX matViewProj = XMLoadFloat4x4(&m_pCamera->matViewProj);
+	XMMATRIX matWorldViewProj = XMMatrixMultiply(matrix, matViewProj);
+	ui32 bgr = cpu::ToBGR(CPU_WHITE);
 
-			DrawLine((int)sa.x, (int)sa.y, sa.z, (int)sb.x, (int)sb.y, sb.z, CPU_WHITE);
+	// Mesh without edges (not optimized): each triangle draws its 3 edges
+	if ( pMesh->edges.empty() )
+	{
+		XMFLOAT4 clip[3];
+		for ( size_t offset=0 ; offset+2<pMesh->vertices.size() ; offset+=3 )
+		{
+			for ( int i=0 ; i<3 ; ++i )
+			{
+				XMVECTOR loc = XMVectorSetW(XMLoadFloat3(&pMesh->vertices[offset+i].pos), 1.0f);
+				XMStoreFloat4(&clip[i], XMVector4Transform(loc, matWorldViewProj));
+			}
+			for ( int e=0 ; e<3 ; ++e )
+				DrawClipLine(clip[e], clip[(e+1)%3], bgr, pTile);
 		}
+		return;
+	}
+
+	// Points: each unique position is projected once
+	static thread_local std::vector<XMFLOAT4> s_clip;
+	s_clip.resize(pMesh->points.size());
+	for ( size_t i=0 ; i<pMesh->points.size() ; ++i )
+	{
+		XMVECTOR loc = XMVectorSetW(XMLoadFloat3(&pMesh->points[i]), 1.0f);
+		XMStoreFloat4(&s_clip[i], XMVector4Transform(loc, matWorldViewProj));
 	}
+
+	// Edges: each unique edge is drawn once
+	for ( size_t i=0 ; i+1<pMesh->edges.size() ; i+=2 )
+		DrawClipLine(s_clip[pMesh->edges[i]], s_clip[pMesh->edges[i+1]], bgr, pTile);
 }
 
 void cpu_device::DrawText(cpu_font* pFont, const char* text, int x, int y, int align, XMFLOAT3* pTint)
@@ -511,16 +1041,32 @@ void cpu_device::DrawText(cpu_font* pFont, const char* text, int x, int y, int a
 	}
 }
 
-void cpu_device::DrawTexture(cpu_texture* pTexture, int x, int y)
+void cpu_device::DrawTexture(cpu_texture* pTexture, int x, int y, cpu_tile* pTile)
 {
 	cpu_rt& rt = *GetRT();
 	byte* dst = (byte*)rt.colorBuffer.data();
-	cpu_img32::AlphaBlend(pTexture->bgra, pTexture->width, pTexture->height, dst, rt.width, rt.height, 0, 0, x, y, pTexture->width, pTexture->height);
+	int srcX = 0;
+	int srcY = 0;
+	int w = pTexture->width;
+	int h = pTexture->height;
+
+	// Tile
+	if ( pTile )
+	{
+		if ( x<pTile->left ) { srcX += pTile->left-x; w -= pTile->left-x; x = pTile->left; }
+		if ( y<pTile->top ) { srcY += pTile->top-y; h -= pTile->top-y; y = pTile->top; }
+		if ( x+w>pTile->right ) w = pTile->right - x;
+		if ( y+h>pTile->bottom ) h = pTile->bottom - y;
+		if ( w<=0 || h<=0 )
+			return;
+	}
+
+	cpu_img32::AlphaBlend(pTexture->bgra, pTexture->width, pTexture->height, dst, rt.width, rt.height, srcX, srcY, x, y, w, h);
 }
 
-void cpu_device::DrawSprite(cpu_sprite* pSprite)
+void cpu_device::DrawSprite(cpu_sprite* pSprite, cpu_tile* pTile)
 {
-	DrawTexture(pSprite->pTexture, pSprite->x-pSprite->anchorX, pSprite->y-pSprite->anchorY);
+	DrawTexture(pSprite->pTexture, pSprite->x-pSprite->anchorX, pSprite->y-pSprite->anchorY, pTile);
 }
 
 void cpu_device::DrawHorzLine(int x1, int x2, int y, XMFLOAT3& color)
@@ -574,53 +1120,9 @@ void cpu_device::FillRectangle(int x, int y, int w, int h, XMFLOAT3& color)
 	}
 }
 
-void cpu_device::DrawLine(int x0, int y0, float z0, int x1, int y1, float z1, XMFLOAT3& color)
+void cpu_device::DrawLine(int x0, int y0, float z0, int x1, int y1, float z1, XMFLOAT3& color, cpu_tile* pTile)
 {
-	cpu_rt& rt = *GetRT();
-	ui32 bgr = cpu::ToBGR(color);
-
-	int dx = abs(x1 - x0);
-	int sx = x0 < x1 ? 1 : -1;
-	int dy = -abs(y1 - y0);
-	int sy = y0 < y1 ? 1 : -1;
-	int err = dx + dy;
-
-	float dist = (float)std::max(dx, abs(dy));
-	if ( dist==0.0f )
-		return;
-
-	float zStep = (z1 - z0) / dist;
-	float currentZ = z0;
-
-	while ( true )
-	{
-		if ( x0>=0 && x0<rt.width && y0>=0 && y0<rt.height )
-		{
-			int index = y0 * rt.width + x0;
-			if ( currentZ<rt.depthBuffer[index] )
-			{
-				rt.colorBuffer[index] = bgr;
-				rt.depthBuffer[index] = currentZ;
-			}
-		}
-
-		if ( x0==x1 && y0==y1 )
-			break;
-
-		int e2 = 2 * err;
-		if ( e2>=dy )
-		{
-			err += dy;
-			x0 += sx;
-		}
-		if ( e2<=dx )
-		{
-			err += dx;
-			y0 += sy;
-		}
-
-		currentZ += zStep;
-	}
+	DrawLine((float)x0, (float)y0, z0, (float)x1, (float)y1, z1, cpu::ToBGR(color), pTile);
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -638,9 +1140,12 @@ void cpu_device::Present()
 
 	m_pRenderTarget->BeginDraw();
 	m_pRenderTarget->Clear(D2D1::ColorF(D2D1::ColorF::Black));
-	m_pBitmap->CopyFromMemory(nullptr, rt.colorBuffer.data(), rt.width*4);
+	D2D1_RECT_U copyRect = D2D1::RectU(0, 0, rt.width, rt.height);
+	m_pBitmap->CopyFromMemory(&copyRect, rt.colorBuffer.data(), rt.width*4);
 	D2D1_RECT_F destRect = D2D1::RectF((float)m_rcFit.left, (float)m_rcFit.top, (float)m_rcFit.right, (float)m_rcFit.bottom);	
-	m_pRenderTarget->DrawBitmap(m_pBitmap, destRect, 1.0f, D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR, NULL);
+	D2D1_RECT_F srcRect = D2D1::RectF(0.0f, 0.0f, (float)rt.width, (float)rt.height);
+	D2D1_BITMAP_INTERPOLATION_MODE mode = rt.width<m_width ? D2D1_BITMAP_INTERPOLATION_MODE_LINEAR : D2D1_BITMAP_INTERPOLATION_MODE_NEAREST_NEIGHBOR;
+	m_pRenderTarget->DrawBitmap(m_pBitmap, destRect, 1.0f, mode, &srcRect);
 	HRESULT hr = m_pRenderTarget->EndDraw();
 	if ( hr==D2DERR_RECREATE_TARGET )
 	{
@@ -689,7 +1194,7 @@ void cpu_device::OnWindowCallback(UINT message, WPARAM wParam, LPARAM lParam)
 		case WM_SHOWWINDOW:
 		case WM_SIZE:
 		{
-			m_rcFit = cpu::ComputeAspectFitRect(m_mainRT.width, m_mainRT.height, m_pWindow->GetWidth(), m_pWindow->GetHeight());
+			m_rcFit = cpu::ComputeAspectFitRect(m_width, m_height, m_pWindow->GetWidth(), m_pWindow->GetHeight());
 #ifdef CPU_CONFIG_GPU
 			if ( m_pRenderTarget )
 				m_pRenderTarget->Resize(D2D1::SizeU(m_pWindow->GetWidth(), m_pWindow->GetHeight()));
@@ -699,6 +1204,25 @@ void cpu_device::OnWindowCallback(UINT message, WPARAM wParam, LPARAM lParam)
 	}
 }
 
+void cpu_device::GetTileRect(cpu_tile* pTile, cpu_rectangle& rc)
+{
+	cpu_rt& rt = *GetRT();
+	if ( pTile )
+	{
+		rc.minX = std::max(pTile->left, 0);
+		rc.minY = std::max(pTile->top, 0);
+		rc.maxX = std::min(pTile->right, rt.width);
+		rc.maxY = std::min(pTile->bottom, rt.height);
+	}
+	else
+	{
+		rc.minX = 0;
+		rc.minY = 0;
+		rc.maxX = rt.width;
+		rc.maxY = rt.height;
+	}
+}
+
 bool cpu_device::ClipToScreen(cpu_draw& draw)
 {
 	cpu_rt& rt = *GetRT();
@@ -729,9 +1253,11 @@ bool cpu_device::ClipToScreen(cpu_draw& draw)
 	return true;
 }
 
+template <typename D>
 void cpu_device::DrawTriangle(cpu_draw& draw)
 {
 	cpu_rt& rt = *GetRT();
+	typename D::type* depth = D::Buffer(rt);
 
 	const float x1 = draw.tri[0].x, y1 = draw.tri[0].y, z1 = draw.tri[0].z;
 	const float x2 = draw.tri[1].x, y2 = draw.tri[1].y, z2 = draw.tri[1].z;
@@ -773,6 +1299,102 @@ void cpu_device::DrawTriangle(cpu_draw& draw)
 
 	float invArea = 1.0f / area;
 	bool areaPositive = area>0.0f;
+	draw.invW[0] = 1.0f / draw.vo[0]->clipPos.w;
+	draw.invW[1] = 1.0f / draw.vo[1]->clipPos.w;
+	draw.invW[2] = 1.0f / draw.vo[2]->clipPos.w;
+
+	const CPU_PS_FUNC func = draw.pMaterial->ps ? draw.pMaterial->ps : &PixelShader;
+	cpu_ps_io io;
+	io.pMaterial = draw.pMaterial;
+
+	// Coarse shading: one shaded value per block, coverage and depth stay per pixel
+	static const int s_rateWidth[] = { 1, 1, 2, 4 };
+	static const int s_rateHeight[] = { 1, 2, 2, 4 };
+	const int rateWidth = s_rateWidth[draw.shadingRate];
+	const int rateHeight = s_rateHeight[draw.shadingRate];
+	if ( rateWidth>1 || rateHeight>1 )
+	{
+		// Blocks are aligned on the screen grid
+		for ( int by=minY-minY%rateHeight ; by<maxY ; by+=rateHeight )
+		{
+			int yStart = std::max(by, minY);
+			int yEnd = std::min(by+rateHeight, maxY);
+			for ( int bx=minX-minX%rateWidth ; bx<maxX ; bx+=rateWidth )
+			{
+				int xStart = std::max(bx, minX);
+				int xEnd = std::min(bx+rateWidth, maxX);
+				bool shaded = false;
+				bool discard = false;
+				ui32 color = 0;
+				for ( int y=yStart ; y<yEnd && discard==false ; y++ )
+				{
+					float py = (float)y + 0.5f;
+					for ( int x=xStart ; x<xEnd ; x++ )
+					{
+						if ( m_checkerboard>=0 && ((x+y+m_checkerboard) & 1) )
+							continue;
+
+						float px = (float)x + 0.5f;
+						float e12 = a12 * px + b12 * py + c12;
+						float e23 = a23 * px + b23 * py + c23;
+						float e31 = a31 * px + b31 * py + c31;
+						if ( areaPositive )
+						{
+							if ( e12<0.0f || e23<0.0f || e31<0.0f )
+								continue;
+						}
+						else
+						{
+							if ( e12>0.0f || e23>0.0f || e31>0.0f )
+								continue;
+						}
+
+						float w0 = e23 * invArea;
+						float w1 = e31 * invArea;
+						float w2 = e12 * invArea;
+						float z = z1*w0 + z2*w1 + z3*w2;
+						if ( z<CPU_EPSILON )
+							continue;
+
+						int index = y * rt.width + x;
+						typename D::type zEnc = D::Encode(z);
+						if ( draw.depth & CPU_DEPTH_EQUAL )
+						{
+							if ( D::Equal(zEnc, depth[index])==false )
+								continue;
+						}
+						else if ( (draw.depth & CPU_DEPTH_READ) && D::Test(zEnc, depth[index])==false )
+							continue;
+
+						// First visible pixel shades the block
+						if ( shaded==false )
+						{
+							io.p.x = x;
+							io.p.y = y;
+							io.p.depth = z;
+							if ( Shade(draw, io, func, w0, w1, w2)==false )
+							{
+								discard = true;
+								break;
+							}
+							color = cpu::ToBGR(io.color);
+							shaded = true;
+						}
+
+						if ( draw.depth & CPU_DEPTH_WRITE )
+							depth[index] = zEnc;
+						rt.colorBuffer[index] = draw.blend==CPU_BLEND_OPAQUE ? color : Blend(rt.colorBuffer[index], io.color, io.alpha, draw.blend);
+					}
+				}
+			}
+		}
+
+		// Stats
+		if ( draw.pTile )
+			draw.pTile->statsDrawnTriangleCount++;
+		return;
+	}
+
 	float startX = (float)minX + 0.5f;
 	float startY = (float)minY + 0.5f;
 	float e12_row = a12 * startX + b12 * startY + c12;
@@ -784,39 +1406,35 @@ void cpu_device::DrawTriangle(cpu_draw& draw)
 	const float dE23dy = b23;
 	const float dE31dx = a31;
 	const float dE31dy = b31;
-	float invW0 = 1.0f / draw.vo[0]->clipPos.w;
-	float invW1 = 1.0f / draw.vo[1]->clipPos.w;
-	float invW2 = 1.0f / draw.vo[2]->clipPos.w;
 
-	const CPU_PS_FUNC func = draw.pMaterial->ps ? draw.pMaterial->ps : &PixelShader;
-	cpu_ps_io io;
-	io.pMaterial = draw.pMaterial;
+	// Checkerboard: every other pixel, alternating each row
+	const int stepX = m_checkerboard>=0 ? 2 : 1;
+	const float stepE12 = dE12dx * stepX;
+	const float stepE23 = dE23dx * stepX;
+	const float stepE31 = dE31dx * stepX;
+
 	for ( int y=minY ; y<maxY ; ++y )
 	{
-		float e12 = e12_row;
-		float e23 = e23_row;
-		float e31 = e31_row;
-		for ( int x=minX ; x<maxX ; ++x )
+		// Checkerboard: first shaded pixel of the row
+		int x0 = minX;
+		if ( m_checkerboard>=0 && ((minX+y+m_checkerboard) & 1) )
+			x0++;
+
+		float offset = (float)(x0 - minX);
+		float e12 = e12_row + dE12dx * offset;
+		float e23 = e23_row + dE23dx * offset;
+		float e31 = e31_row + dE31dx * offset;
+		for ( int x=x0 ; x<maxX ; x+=stepX, e12+=stepE12, e23+=stepE23, e31+=stepE31 )
 		{
 			if ( areaPositive )
 			{
 				if ( e12<0.0f || e23<0.0f || e31<0.0f )
-				{
-					e12 += dE12dx;
-					e23 += dE23dx;
-					e31 += dE31dx;
 					continue;
-				}
 			}
 			else
 			{
 				if ( e12>0.0f || e23>0.0f || e31>0.0f )
-				{
-					e12 += dE12dx;
-					e23 += dE23dx;
-					e31 += dE31dx;
 					continue;
-				}
 			}
 
 			float w0 = e23 * invArea;
@@ -824,106 +1442,30 @@ void cpu_device::DrawTriangle(cpu_draw& draw)
 			float w2 = e12 * invArea;
 			float z = z1*w0 + z2*w1 + z3*w2;
 			if ( z<CPU_EPSILON )
-			{
-				e12 += dE12dx;
-				e23 += dE23dx;
-				e31 += dE31dx;
 				continue;
-			}
 
 			int index = y * rt.width + x;
-			if ( (draw.depth & CPU_DEPTH_READ) && z>=rt.depthBuffer[index] )
+			typename D::type zEnc = D::Encode(z);
+			if ( draw.depth & CPU_DEPTH_EQUAL )
 			{
-				e12 += dE12dx;
-				e23 += dE23dx;
-				e31 += dE31dx;
-				continue;
+				if ( D::Equal(zEnc, depth[index])==false )
+					continue;
 			}
-
-			float iw0 = w0*invW0;
-			float iw1 = w1*invW1;
-			float iw2 = w2*invW2;
-			float invW = iw0 + iw1 + iw2;
-			if ( fabsf(invW)<CPU_EPSILON )
-			{
-				e12 += dE12dx;
-				e23 += dE23dx;
-				e31 += dE31dx;
+			else if ( (draw.depth & CPU_DEPTH_READ) && D::Test(zEnc, depth[index])==false )
 				continue;
-			}
-			float w = 1.0f / invW;
 
 			// cpu_input
 			io.p.x = x;
 			io.p.y = y;
 			io.p.depth = z;
 
-			// Position (interp)
-			io.p.pos.x = (iw0*draw.vo[0]->worldPos.x + iw1*draw.vo[1]->worldPos.x + iw2*draw.vo[2]->worldPos.x) * w;
-			io.p.pos.y = (iw0*draw.vo[0]->worldPos.y + iw1*draw.vo[1]->worldPos.y + iw2*draw.vo[2]->worldPos.y) * w;
-			io.p.pos.z = (iw0*draw.vo[0]->worldPos.z + iw1*draw.vo[1]->worldPos.z + iw2*draw.vo[2]->worldPos.z) * w;
-
-			// Normal (interp)
-			io.p.normal.x = (iw0*draw.vo[0]->worldNormal.x + iw1*draw.vo[1]->worldNormal.x + iw2*draw.vo[2]->worldNormal.x) * w;
-			io.p.normal.y = (iw0*draw.vo[0]->worldNormal.y + iw1*draw.vo[1]->worldNormal.y + iw2*draw.vo[2]->worldNormal.y) * w;
-			io.p.normal.z = (iw0*draw.vo[0]->worldNormal.z + iw1*draw.vo[1]->worldNormal.z + iw2*draw.vo[2]->worldNormal.z) * w;
-			XMVECTOR normal = XMVector3NormalizeEst(XMLoadFloat3(&io.p.normal));
-			XMStoreFloat3(&io.p.normal, normal);
-
-			// Color (interp)
-			io.p.albedo.x = (iw0*draw.vo[0]->albedo.x + iw1*draw.vo[1]->albedo.x + iw2*draw.vo[2]->albedo.x) * w;
-			io.p.albedo.y = (iw0*draw.vo[0]->albedo.y + iw1*draw.vo[1]->albedo.y + iw2*draw.vo[2]->albedo.y) * w;
-			io.p.albedo.z = (iw0*draw.vo[0]->albedo.z + iw1*draw.vo[1]->albedo.z + iw2*draw.vo[2]->albedo.z) * w;
-
-			// UV (interp)
-			if ( draw.pMaterial->pTexture )
-			{
-				io.p.uv.x = (w0*draw.vo[0]->uv.x + w1*draw.vo[1]->uv.x + w2*draw.vo[2]->uv.x) * w;
-				io.p.uv.y = (w0*draw.vo[0]->uv.y + w1*draw.vo[1]->uv.y + w2*draw.vo[2]->uv.y) * w;
-			}
-			else
-			{
-				io.p.uv.x = 0.0f;
-				io.p.uv.y = 0.0f;
-			}
-
-			// Lighting
-			if ( draw.pMaterial->lighting==CPU_LIGHTING_GOURAUD )
-			{
-				float intensity = (iw0*draw.vo[0]->intensity + iw1*draw.vo[1]->intensity + iw2*draw.vo[2]->intensity) * w;
-				io.p.color.x = io.p.albedo.x * intensity;
-				io.p.color.y = io.p.albedo.y * intensity;
-				io.p.color.z = io.p.albedo.z * intensity;
-			}
-			else if ( draw.pMaterial->lighting==CPU_LIGHTING_LAMBERT )
-			{
-				XMVECTOR l = XMLoadFloat3(&m_pLight->dir);
-				float ndotl = XMVectorGetX(XMVector3Dot(normal, l));
-				if ( ndotl<0.0f )
-					ndotl = 0.0f;
-				float intensity = ndotl + m_pLight->ambient;
-				io.p.color.x = io.p.albedo.x * intensity;
-				io.p.color.y = io.p.albedo.y * intensity;
-				io.p.color.z = io.p.albedo.z * intensity;
-			}
-			else
-				io.p.color = io.p.albedo;
-
 			// Output
-			io.values = draw.pMaterial->values;
-			io.color = {};
-			io.discard = false;
-			func(io);
-			if ( io.discard==false )
+			if ( Shade(draw, io, func, w0, w1, w2) )
 			{
 				if ( draw.depth & CPU_DEPTH_WRITE )
-					rt.depthBuffer[index] = z;
-				rt.colorBuffer[index] = cpu::ToBGR(io.color);
+					depth[index] = zEnc;
+				rt.colorBuffer[index] = draw.blend==CPU_BLEND_OPAQUE ? cpu::ToBGR(io.color) : Blend(rt.colorBuffer[index], io.color, io.alpha, draw.blend);
 			}
-
-			e12 += dE12dx;
-			e23 += dE23dx;
-			e31 += dE31dx;
 		}
 
 		e12_row += dE12dy;
@@ -936,11 +1478,209 @@ void cpu_device::DrawTriangle(cpu_draw& draw)
 		draw.pTile->statsDrawnTriangleCount++;
 }
 
+template <typename D>
+void cpu_device::DrawTriangleDepth(cpu_draw& draw)
+{
+	cpu_rt& rt = *GetRT();
+	typename D::type* depth = D::Buffer(rt);
+
+	const float x1 = draw.tri[0].x, y1 = draw.tri[0].y, z1 = draw.tri[0].z;
+	const float x2 = draw.tri[1].x, y2 = draw.tri[1].y, z2 = draw.tri[1].z;
+	const float x3 = draw.tri[2].x, y3 = draw.tri[2].y, z3 = draw.tri[2].z;
+
+	int minX = std::max((int)floor(std::min(std::min(x1, x2), x3)), 0);
+	int maxX = std::min((int)ceil(std::max(std::max(x1, x2), x3)), rt.width);
+	int minY = std::max((int)floor(std::min(std::min(y1, y2), y3)), 0);
+	int maxY = std::min((int)ceil(std::max(std::max(y1, y2), y3)), rt.height);
+	if ( draw.pTile )
+	{
+		minX = std::max(minX, draw.pTile->left);
+		maxX = std::min(maxX, draw.pTile->right);
+		minY = std::max(minY, draw.pTile->top);
+		maxY = std::min(maxY, draw.pTile->bottom);
+	}
+	if ( minX>=maxX || minY>=maxY )
+		return;
+
+	// Edges and depth plane (same setup as DrawTriangle)
+	float a12 = y1 - y2, b12 = x2 - x1, c12 = x1 * y2 - x2 * y1;
+	float a23 = y2 - y3, b23 = x3 - x2, c23 = x2 * y3 - x3 * y2;
+	float a31 = y3 - y1, b31 = x1 - x3, c31 = x3 * y1 - x1 * y3;
+	float area = a12 * x3 + b12 * y3 + c12;
+	if ( fabsf(area)<CPU_EPSILON )
+		return;
+	float invArea = 1.0f / area;
+	bool areaPositive = area>0.0f;
+
+	float startX = (float)minX + 0.5f;
+	float startY = (float)minY + 0.5f;
+	float e12_row = a12 * startX + b12 * startY + c12;
+	float e23_row = a23 * startX + b23 * startY + c23;
+	float e31_row = a31 * startX + b31 * startY + c31;
+	const int stepX = m_checkerboard>=0 ? 2 : 1;
+
+	for ( int y=minY ; y<maxY ; ++y )
+	{
+		int x0 = minX;
+		if ( m_checkerboard>=0 && ((minX+y+m_checkerboard) & 1) )
+			x0++;
+
+		float offset = (float)(x0 - minX);
+		float e12 = e12_row + a12 * offset;
+		float e23 = e23_row + a23 * offset;
+		float e31 = e31_row + a31 * offset;
+		typename D::type* row = depth + y * rt.width;
+		for ( int x=x0 ; x<maxX ; x+=stepX, e12+=a12*stepX, e23+=a23*stepX, e31+=a31*stepX )
+		{
+			if ( areaPositive ? (e12<0.0f || e23<0.0f || e31<0.0f) : (e12>0.0f || e23>0.0f || e31>0.0f) )
+				continue;
+
+			// Same interpolation as DrawTriangle (CPU_DEPTH_EQUAL after a prepass)
+			float z = z1*(e23*invArea) + z2*(e31*invArea) + z3*(e12*invArea);
+			if ( z<CPU_EPSILON )
+				continue;
+
+			typename D::type zEnc = D::Encode(z);
+			if ( D::Test(zEnc, row[x]) )
+				row[x] = zEnc;
+		}
+
+		e12_row += b12;
+		e23_row += b23;
+		e31_row += b31;
+	}
+}
+
+bool cpu_device::Shade(cpu_draw& draw, cpu_ps_io& io, const CPU_PS_FUNC func, float w0, float w1, float w2)
+{
+	float iw0 = w0*draw.invW[0];
+	float iw1 = w1*draw.invW[1];
+	float iw2 = w2*draw.invW[2];
+	float invW = iw0 + iw1 + iw2;
+	if ( fabsf(invW)<CPU_EPSILON )
+		return false;
+	float w = 1.0f / invW;
+
+	// Position (interp)
+	io.p.pos.x = (iw0*draw.vo[0]->worldPos.x + iw1*draw.vo[1]->worldPos.x + iw2*draw.vo[2]->worldPos.x) * w;
+	io.p.pos.y = (iw0*draw.vo[0]->worldPos.y + iw1*draw.vo[1]->worldPos.y + iw2*draw.vo[2]->worldPos.y) * w;
+	io.p.pos.z = (iw0*draw.vo[0]->worldPos.z + iw1*draw.vo[1]->worldPos.z + iw2*draw.vo[2]->worldPos.z) * w;
+
+	// Normal (interp)
+	io.p.normal.x = (iw0*draw.vo[0]->worldNormal.x + iw1*draw.vo[1]->worldNormal.x + iw2*draw.vo[2]->worldNormal.x) * w;
+	io.p.normal.y = (iw0*draw.vo[0]->worldNormal.y + iw1*draw.vo[1]->worldNormal.y + iw2*draw.vo[2]->worldNormal.y) * w;
+	io.p.normal.z = (iw0*draw.vo[0]->worldNormal.z + iw1*draw.vo[1]->worldNormal.z + iw2*draw.vo[2]->worldNormal.z) * w;
+	XMVECTOR normal = XMVector3NormalizeEst(XMLoadFloat3(&io.p.normal));
+	XMStoreFloat3(&io.p.normal, normal);
+
+	// Color (interp)
+	io.p.albedo.x = (iw0*draw.vo[0]->albedo.x + iw1*draw.vo[1]->albedo.x + iw2*draw.vo[2]->albedo.x) * w;
+	io.p.albedo.y = (iw0*draw.vo[0]->albedo.y + iw1*draw.vo[1]->albedo.y + iw2*draw.vo[2]->albedo.y) * w;
+	io.p.albedo.z = (iw0*draw.vo[0]->albedo.z + iw1*draw.vo[1]->albedo.z + iw2*draw.vo[2]->albedo.z) * w;
+
+	// UV (interp)
+	if ( draw.pMaterial->pTexture )
+	{
+		io.p.uv.x = (w0*draw.vo[0]->uv.x + w1*draw.vo[1]->uv.x + w2*draw.vo[2]->uv.x) * w;
+		io.p.uv.y = (w0*draw.vo[0]->uv.y + w1*draw.vo[1]->uv.y + w2*draw.vo[2]->uv.y) * w;
+	}
+	else
+	{
+		io.p.uv.x = 0.0f;
+		io.p.uv.y = 0.0f;
+	}
+
+	// Lighting
+	if ( draw.pMaterial->lighting==CPU_LIGHTING_BAKED )
+	{
+		// Static light and occlusion are in the vertex intensity, dynamic lights are added
+		float intensity = (iw0*draw.vo[0]->intensity + iw1*draw.vo[1]->intensity + iw2*draw.vo[2]->intensity) * w;
+		io.p.color.x = io.p.albedo.x * intensity;
+		io.p.color.y = io.p.albedo.y * intensity;
+		io.p.color.z = io.p.albedo.z * intensity;
+		if ( draw.pTile && draw.pTile->lights.size() )
+			AddTileLights(draw.pTile, normal, io.p);
+	}
+	else if ( draw.pMaterial->lighting==CPU_LIGHTING_GOURAUD )
+	{
+		float intensity = (iw0*draw.vo[0]->intensity + iw1*draw.vo[1]->intensity + iw2*draw.vo[2]->intensity) * w;
+		if ( m_pShadowMap )
+			intensity = m_pLight->ambient + (intensity - m_pLight->ambient) * GetShadow(io.p.pos);
+		io.p.color.x = io.p.albedo.x * intensity;
+		io.p.color.y = io.p.albedo.y * intensity;
+		io.p.color.z = io.p.albedo.z * intensity;
+		if ( draw.pTile && draw.pTile->lights.size() )
+			AddTileLights(draw.pTile, normal, io.p);
+	}
+	else if ( draw.pMaterial->lighting==CPU_LIGHTING_LAMBERT )
+	{
+		XMVECTOR l = XMLoadFloat3(&m_pLight->dir);
+		float ndotl = XMVectorGetX(XMVector3Dot(normal, l));
+		if ( ndotl<0.0f )
+			ndotl = 0.0f;
+		if ( m_pShadowMap && ndotl>0.0f )
+			ndotl *= GetShadow(io.p.pos);
+		float intensity = ndotl + m_pLight->ambient;
+		io.p.color.x = io.p.albedo.x * intensity;
+		io.p.color.y = io.p.albedo.y * intensity;
+		io.p.color.z = io.p.albedo.z * intensity;
+		if ( draw.pTile && draw.pTile->lights.size() )
+			AddTileLights(draw.pTile, normal, io.p);
+	}
+	else
+		io.p.color = io.p.albedo;
+
+	// Pixel shader
+	io.values = draw.pMaterial->values;
+	io.color = {};
+	io.alpha = draw.pMaterial->alpha;
+	io.discard = false;
+	func(io);
+	return io.discard==false;
+}
+
+void XM_CALLCONV cpu_device::AddTileLights(cpu_tile* pTile, FXMVECTOR normal, cpu_pixel& p)
+{
+	// Point and spot lights of the tile only (culled by the engine)
+	XMVECTOR pos = XMLoadFloat3(&p.pos);
+	for ( cpu_light* pLight : pTile->lights )
+	{
+		XMVECTOR toLight = XMVectorSubtract(XMLoadFloat3(&pLight->pos), pos);
+		float dist2 = XMVectorGetX(XMVector3LengthSq(toLight));
+		float range2 = pLight->range * pLight->range;
+		if ( dist2>=range2 )
+			continue;
+
+		XMVECTOR l = XMVectorScale(toLight, 1.0f / sqrtf(dist2 + CPU_EPSILON));
+		float ndotl = XMVectorGetX(XMVector3Dot(normal, l));
+		if ( ndotl<=0.0f )
+			continue;
+
+		// Smooth falloff, zero at range
+		float falloff = 1.0f - dist2 / range2;
+		float intensity = ndotl * falloff * falloff;
+
+		// Cone: full on the axis, zero on the edge
+		if ( pLight->type==CPU_LIGHT_SPOT )
+		{
+			float cosAngle = -XMVectorGetX(XMVector3Dot(l, XMLoadFloat3(&pLight->dir)));
+			if ( cosAngle<=pLight->spotCos )
+				continue;
+			intensity *= (cosAngle - pLight->spotCos) / (1.0f - pLight->spotCos + CPU_EPSILON);
+		}
+
+		p.color.x += p.albedo.x * pLight->color.x * intensity;
+		p.color.y += p.albedo.y * pLight->color.y * intensity;
+		p.color.z += p.albedo.z * pLight->color.z * intensity;
+	}
+}
+
 bool cpu_device::WireframeClipLineNearPlane(XMFLOAT4& a, XMFLOAT4& b)
 {
-	// Plan near D3D en clip-space : z >= 0
-	const float da = a.z;
-	const float db = b.z;
+	// Plan near D3D en clip-space : z >= 0 (reversed-Z : z <= w)
+	const bool reversed = GetRT()->depthFormat==CPU_DEPTH_FORMAT_F32_REVERSED;
+	const float da = reversed ? a.w - a.z : a.z;
+	const float db = reversed ? b.w - b.z : b.z;
 
 	// Si les deux sont derrire
 	if ( da<0.0f && db<0.0f )
@@ -954,7 +1694,7 @@ bool cpu_device::WireframeClipLineNearPlane(XMFLOAT4& a, XMFLOAT4& b)
 		XMFLOAT4 p;
 		p.x = a.x + (b.x - a.x) * t;
 		p.y = a.y + (b.y - a.y) * t;
-		p.z = a.z + (b.z - a.z) * t; // ~0
+		p.z = a.z + (b.z - a.z) * t; // ~0 (~w en reversed-Z)
 		p.w = a.w + (b.w - a.w) * t;
 
 		if ( da<0.0f )
@@ -984,6 +1724,160 @@ bool cpu_device::WireframeClipToScreen(const XMFLOAT4& c, float widthHalf, float
 	return true;
 }
 
+void cpu_device::DrawClipLine(XMFLOAT4 a, XMFLOAT4 b, ui32 bgr, cpu_tile* pTile)
+{
+	cpu_rt& rt = *GetRT();
+	if ( WireframeClipLineNearPlane(a, b)==false )
+		return;
+
+	XMFLOAT3 sa, sb;
+	if ( WireframeClipToScreen(a, rt.widthHalf, rt.heightHalf, sa)==false )
+		return;
+	if ( WireframeClipToScreen(b, rt.widthHalf, rt.heightHalf, sb)==false )
+		return;
+
+	DrawLine(sa.x, sa.y, sa.z, sb.x, sb.y, sb.z, bgr, pTile);
+}
+
+void cpu_device::DrawLine(float x0, float y0, float z0, float x1, float y1, float z1, ui32 bgr, cpu_tile* pTile)
+{
+	switch ( GetRT()->depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		RasterLine<cpu_depth_u16>(x0, y0, z0, x1, y1, z1, bgr, pTile);
+		break;
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		RasterLine<cpu_depth_f32_reversed>(x0, y0, z0, x1, y1, z1, bgr, pTile);
+		break;
+	default:
+		RasterLine<cpu_depth_f32>(x0, y0, z0, x1, y1, z1, bgr, pTile);
+		break;
+	}
+}
+
+bool cpu_device::ClipLine(float p, float d, float min, float max, float& t0, float& t1)
+{
+	// Liang-Barsky: restrict [t0,t1] so that p+t*d stays in [min,max]
+	if ( fabsf(d)<CPU_EPSILON )
+		return p>=min && p<=max;
+
+	float ta = (min - p) / d;
+	float tb = (max - p) / d;
+	if ( ta>tb )
+		std::swap(ta, tb);
+	t0 = std::max(t0, ta);
+	t1 = std::min(t1, tb);
+	return t0<=t1;
+}
+
+template <typename D>
+void cpu_device::RasterLine(float x0, float y0, float z0, float x1, float y1, float z1, ui32 bgr, cpu_tile* pTile)
+{
+	cpu_rt& rt = *GetRT();
+	if ( rt.width<=0 || rt.height<=0 )
+		return;
+
+	// Screen clipping (same result for every tile)
+	float t0 = 0.0f;
+	float t1 = 1.0f;
+	float dx = x1 - x0;
+	float dy = y1 - y0;
+	if ( ClipLine(x0, dx, 0.0f, (float)rt.width-1.0f, t0, t1)==false )
+		return;
+	if ( ClipLine(y0, dy, 0.0f, (float)rt.height-1.0f, t0, t1)==false )
+		return;
+	int ix0 = (int)(x0 + dx*t0);
+	int iy0 = (int)(y0 + dy*t0);
+	int ix1 = (int)(x0 + dx*t1);
+	int iy1 = (int)(y0 + dy*t1);
+	float iz0 = z0 + (z1-z0)*t0;
+	float iz1 = z0 + (z1-z0)*t1;
+
+	// DDA (16.16 fixed point): pixel i = start + i*step, i in [0,count]
+	int count = std::max(abs(ix1-ix0), abs(iy1-iy0));
+	int stepX = count ? ((ix1-ix0)*65536) / count : 0;
+	int stepY = count ? ((iy1-iy0)*65536) / count : 0;
+	float stepZ = count ? (iz1-iz0) / (float)count : 0.0f;
+	int fx0 = ix0*65536 + 32768;
+	int fy0 = iy0*65536 + 32768;
+
+	// Tile clipping: range of i inside the tile
+	cpu_rectangle rc;
+	GetTileRect(pTile, rc);
+	float tMin = 0.0f;
+	float tMax = (float)count;
+	if ( ClipLine((float)ix0, count ? (float)(ix1-ix0)/count : 0.0f, (float)rc.minX, (float)rc.maxX-1.0f, tMin, tMax)==false )
+		return;
+	if ( ClipLine((float)iy0, count ? (float)(iy1-iy0)/count : 0.0f, (float)rc.minY, (float)rc.maxY-1.0f, tMin, tMax)==false )
+		return;
+	int iStart = std::max(0, (int)floorf(tMin)-1);
+	int iEnd = std::min(count, (int)ceilf(tMax)+1);
+	auto inside = [&](int i)
+	{
+		int x = (fx0 + i*stepX) >> 16;
+		int y = (fy0 + i*stepY) >> 16;
+		return x>=rc.minX && x<rc.maxX && y>=rc.minY && y<rc.maxY;
+	};
+	while ( iStart<=iEnd && inside(iStart)==false )
+		iStart++;
+	while ( iEnd>=iStart && inside(iEnd)==false )
+		iEnd--;
+	if ( iStart>iEnd )
+		return;
+
+	// 4 pixels per iteration (float formats)
+	ui32* color = rt.colorBuffer.data();
+	typename D::type* depth = D::Buffer(rt);
+	int fx = fx0 + iStart*stepX;
+	int fy = fy0 + iStart*stepY;
+	float z = iz0 + iStart*stepZ;
+	const __m128 ramp = _mm_setr_ps(0.0f, stepZ, stepZ*2.0f, stepZ*3.0f);
+	int i = iStart;
+	if constexpr ( std::is_same_v<typename D::type, float> )
+	{
+		for ( ; i+3<=iEnd ; i+=4 )
+		{
+			int index[4];
+			for ( int k=0 ; k<4 ; k++ )
+			{
+				index[k] = (fy>>16) * rt.width + (fx>>16);
+				fx += stepX;
+				fy += stepY;
+			}
+			__m128 zs = _mm_add_ps(_mm_set1_ps(z), ramp);
+			__m128 ds = _mm_setr_ps(depth[index[0]], depth[index[1]], depth[index[2]], depth[index[3]]);
+			int mask = _mm_movemask_ps(D::reversed ? _mm_cmpgt_ps(zs, ds) : _mm_cmplt_ps(zs, ds));
+			if ( mask )
+			{
+				float zv[4];
+				_mm_storeu_ps(zv, zs);
+				for ( int k=0 ; k<4 ; k++ )
+				{
+					if ( (mask>>k) & 1 )
+					{
+						color[index[k]] = bgr;
+						depth[index[k]] = zv[k];
+					}
+				}
+			}
+			z += stepZ * 4.0f;
+		}
+	}
+	for ( ; i<=iEnd ; i++ )
+	{
+		int index = (fy>>16) * rt.width + (fx>>16);
+		typename D::type zEnc = D::Encode(z);
+		if ( D::Test(zEnc, depth[index]) )
+		{
+			color[index] = bgr;
+			depth[index] = zEnc;
+		}
+		fx += stepX;
+		fy += stepY;
+		z += stepZ;
+	}
+}
+
 float cpu_device::PlaneEval(const XMFLOAT4& p, const XMFLOAT4& c)
 {
 	return p.x * c.x + p.y * c.y + p.z * c.z + p.w * c.w;
@@ -1087,6 +1981,33 @@ int cpu_device::ClipTriangleFrustum(const cpu_vertex_out tri[3], cpu_vertex_out
 	return n; // 3..7
 }
 
+ui32 cpu_device::Blend(ui32 dst, const XMFLOAT3& color, float alpha, int blend)
+{
+	// One pixel in 4 lanes (b, g, r, x), 0..255
+	const __m128i zero = _mm_setzero_si128();
+	__m128 d = _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128((int)dst), zero), zero));
+	__m128 s = _mm_mul_ps(_mm_setr_ps(color.z, color.y, color.x, 0.0f), _mm_set1_ps(255.0f));
+	__m128 a = _mm_set1_ps(alpha);
+	__m128 out;
+	switch ( blend )
+	{
+		case CPU_BLEND_ADD:
+			out = _mm_add_ps(d, _mm_mul_ps(s, a));
+			break;
+		case CPU_BLEND_PREMULTIPLIED:
+			out = _mm_add_ps(s, _mm_mul_ps(d, _mm_sub_ps(_mm_set1_ps(1.0f), a)));
+			break;
+		default:
+			out = _mm_add_ps(d, _mm_mul_ps(_mm_sub_ps(s, d), a));
+			break;
+	}
+
+	// Saturate back to 8 bits
+	__m128i i32 = _mm_cvttps_epi32(_mm_max_ps(out, _mm_setzero_ps()));
+	__m128i i8 = _mm_packus_epi16(_mm_packs_epi32(i32, zero), zero);
+	return (ui32)_mm_cvtsi128_si32(i8) | 0xFF000000;
+}
+
 void cpu_device::PixelShader(cpu_ps_io& io)
 {
 	if ( io.pMaterial->pTexture )
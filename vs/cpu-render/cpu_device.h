@@ -8,6 +8,7 @@ public:
 
 	bool Create(cpu_window* pWindow, int width, int height);
 	void Destroy();
+	bool Resize(int width, int height);
 	void Fix();
 
 	void SetDefaultCamera();
@@ -16,48 +17,95 @@ public:
 
 	void SetDefaultLight();
 	void SetLight(cpu_light* pLight);
+	cpu_light* GetLight() { return m_pLight; }
 
 	int GetWidth() { return m_mainRT.width; }
 	int GetHeight() { return m_mainRT.height; }
 	int GetPixelCount() { return m_mainRT.pixelCount; }
+	int GetFullWidth() { return m_width; }
+	int GetFullHeight() { return m_height; }
 	RECT& GetFit() { return m_rcFit; }
 	cpu_rt* SetMainRT(bool copyDepth = true);
 	cpu_rt* GetMainRT() { return &m_mainRT; }
 	cpu_rt* SetRT(cpu_rt* pRT, bool copyDepth = true);
 	cpu_rt* GetRT() { return m_pRT; }
 	void CopyDepth(cpu_rt* pRT);
+	void SetDepthFormat(int format);
+	int GetDepthFormat() { return m_mainRT.depthFormat; }
 	void AlphaBlend(cpu_rt* pRT);
-	void ToAmigaStyle();
+	void ToAmigaStyle(cpu_tile* pTile = nullptr);
 	void Blur(int radius);
+	void Reconstruct(cpu_rt* pHistory, cpu_rt* pOutHistory, XMFLOAT4X4& prevViewProj, XMFLOAT4X4& invViewProj, cpu_tile* pTile = nullptr);
 
-	void ClearColor();
-	void ClearColor(XMFLOAT3& rgb);
-	void ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor);
-	void ClearDepth();
+	// Effects: chain applied in one pass per tile (per-pixel effects are fused, a blur reads a halo around the tile).
+	// With a blur, tiles write to a second buffer and ResolveEffects swaps it once every tile is done.
+	void ClearEffects() { m_effects.clear(); }
+	void AddTint(XMFLOAT3& color, float amount = 1.0f);
+	void AddAmigaStyle();
+	void AddBlur(int radius);
+	void AddBlend(cpu_rt* pRT);
+	bool HasEffects() { return m_effects.size()>0; }
+	void ApplyEffects(cpu_tile* pTile = nullptr);
+	void ResolveEffects();
 
-	void DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_material* pMaterial, int depthMode = CPU_DEPTH_RW, cpu_tile* pTile = nullptr);
+	// Checkerboard: -1 shades all pixels, 0 or 1 only shades pixels where (x+y+phase) is even
+	void SetCheckerboard(int phase) { m_checkerboard = phase; }
+	int GetCheckerboard() { return m_checkerboard; }
+
+	// Shadow: depth map of the light and matrix from world to shadow map pixels, sampled by the lighting (nullptr: no shadow)
+	void SetShadowMap(cpu_rt* pShadowMap, XMFLOAT4X4* pMatrix = nullptr);
+	float GetShadow(XMFLOAT3& pos);
+
+	// Shading rate: coarsest rate allowed by the contrast of the rendered tile
+	int EstimateShadingRate(cpu_tile* pTile);
+
+	void ClearColor(cpu_tile* pTile = nullptr);
+	void ClearColor(XMFLOAT3& rgb, cpu_tile* pTile = nullptr);
+	void ClearSky(XMFLOAT3& groundColor, XMFLOAT3& skyColor, cpu_tile* pTile = nullptr);
+	void ClearDepth(cpu_tile* pTile = nullptr);
+
+	void DrawMesh(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_material* pMaterial, int depthMode = CPU_DEPTH_RW, cpu_tile* pTile = nullptr, int shadingRate = CPU_SHADING_RATE_1X1, const float* pBakedLight = nullptr);
+	void DrawMeshDepth(cpu_mesh* pMesh, cpu_transform* pTransform, cpu_tile* pTile = nullptr);
 	void XM_CALLCONV DrawWireframeMesh(cpu_mesh* pMesh, FXMMATRIX matrix, cpu_tile* pTile = nullptr);
 	void DrawText(cpu_font* pFont, const char* text, int x, int y, int align = CPU_TEXT_LEFT, XMFLOAT3* pTint = nullptr);
-	void DrawTexture(cpu_texture* pTexture, int x, int y);
-	void DrawSprite(cpu_sprite* pSprite);
+	void DrawTexture(cpu_texture* pTexture, int x, int y, cpu_tile* pTile = nullptr);
+	void DrawSprite(cpu_sprite* pSprite, cpu_tile* pTile = nullptr);
 	void DrawHorzLine(int x1, int x2, int y, XMFLOAT3& color);
 	void DrawVertLine(int y1, int y2, int x, XMFLOAT3& color);
 	void DrawRectangle(int x, int y, int w, int h, XMFLOAT3& color);
 	void FillRectangle(int x, int y, int w, int h, XMFLOAT3& color);
-	void DrawLine(int x0, int y0, float z0, int x1, int y1, float z1, XMFLOAT3& color);
+	void DrawLine(int x0, int y0, float z0, int x1, int y1, float z1, XMFLOAT3& color, cpu_tile* pTile = nullptr);
+	void DrawLine(float x0, float y0, float z0, float x1, float y1, float z1, ui32 bgr, cpu_tile* pTile = nullptr);
 
 	void Present();
 
 private:
 	void OnWindowCallback(UINT message, WPARAM wParam, LPARAM lParam);
+	void GetTileRect(cpu_tile* pTile, cpu_rectangle& rc);
+	void FillColor(ui32 bgr, cpu_tile* pTile);
+	int GetEffectHalo();
+	template <typename D>
+	void FillDepth(cpu_tile* pTile);
+	template <typename D>
+	void ReconstructTile(cpu_rt* pHistory, cpu_rt* pOutHistory, XMFLOAT4X4& prevViewProj, XMFLOAT4X4& invViewProj, cpu_tile* pTile);
 	bool ClipToScreen(cpu_draw& draw);
+	template <typename D>
 	void DrawTriangle(cpu_draw& draw);
+	template <typename D>
+	void DrawTriangleDepth(cpu_draw& draw);
+	bool Shade(cpu_draw& draw, cpu_ps_io& io, const CPU_PS_FUNC func, float w0, float w1, float w2);
+	void XM_CALLCONV AddTileLights(cpu_tile* pTile, FXMVECTOR normal, cpu_pixel& p);
+	void DrawClipLine(XMFLOAT4 a, XMFLOAT4 b, ui32 bgr, cpu_tile* pTile);
+	template <typename D>
+	void RasterLine(float x0, float y0, float z0, float x1, float y1, float z1, ui32 bgr, cpu_tile* pTile);
+	bool ClipLine(float p, float d, float min, float max, float& t0, float& t1);
 	bool WireframeClipLineNearPlane(XMFLOAT4& a, XMFLOAT4& b);
 	bool WireframeClipToScreen(const XMFLOAT4& c, float widthHalf, float heightHalf, XMFLOAT3& out);
 	inline float PlaneEval(const XMFLOAT4& p, const XMFLOAT4& c);
 	int ClipPolyAgainstPlane(const cpu_vertex_out* pInV, int inCount, cpu_vertex_out* pOutV, const XMFLOAT4& plane);
 	int ClipTriangleFrustum(const cpu_vertex_out tri[3], cpu_vertex_out outV[8]);
 	static void PixelShader(cpu_ps_io& io);
+	static ui32 Blend(ui32 dst, const XMFLOAT3& color, float alpha, int blend);
 
 private:
 	// Render
@@ -66,6 +114,7 @@ private:
 	int m_height;
 	RECT m_rcFit;
 	cpu_window* m_pWindow;
+	int m_checkerboard;
 
 	// Surface
 #ifdef CPU_CONFIG_GPU
@@ -80,6 +129,10 @@ private:
 	cpu_rt m_mainRT;
 	cpu_rt* m_pRT;
 
+	// Effect
+	std::vector<cpu_effect> m_effects;
+	std::vector<ui32> m_effectBuffer;
+
 	// Camera
 	bool m_cullFrontCCW = false; // DirectX default
 	float m_cullAreaEpsilon = CPU_EPSILON;
@@ -92,4 +145,8 @@ private:
 	// Light
 	cpu_light m_defaultLight;
 	cpu_light* m_pLight;
+
+	// Shadow
+	cpu_rt* m_pShadowMap;
+	XMFLOAT4X4 m_shadowMatrix;
 };
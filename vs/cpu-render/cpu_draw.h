@@ -8,4 +8,7 @@ public:
 	cpu_material* pMaterial;
 	cpu_tile* pTile;
 	byte depth;
+	byte shadingRate;
+	byte blend;
+	float invW[3];
 };
@@ -0,0 +1,10 @@
+#include "pch.h"
+
+cpu_effect::cpu_effect()
+{
+	type = CPU_EFFECT_TINT;
+	radius = 0;
+	color = CPU_WHITE;
+	amount = 1.0f;
+	pRT = nullptr;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+struct cpu_effect
+{
+public:
+	byte type;
+	int radius;					// Blur
+	XMFLOAT3 color;				// Tint
+	float amount;				// Tint
+	cpu_rt* pRT;				// Blend
+
+public:
+	cpu_effect();
+};
@@ -2,7 +2,13 @@
 
 cpu_light::cpu_light()
 {
+	type = CPU_LIGHT_DIRECTIONAL;
 	dir = { 0.5f, -1.0f, 0.5f };
 	XMStoreFloat3(&dir, XMVector3Normalize(XMLoadFloat3(&dir)));
+	pos = { 0.0f, 0.0f, 0.0f };
+	color = { 1.0f, 1.0f, 1.0f };
+	range = 10.0f;
+	spotCos = 0.7071f;
 	ambient = 0.2f;
+	shadowBias = CPU_SHADOW_BIAS;
 }
@@ -1,10 +1,16 @@
 #pragma once
 
-struct cpu_light
+struct cpu_light : public cpu_object
 {
 public:
-	XMFLOAT3 dir;
+	byte type;					// CPU_LIGHT_DIRECTIONAL (device light), CPU_LIGHT_POINT or CPU_LIGHT_SPOT (culled per tile)
+	XMFLOAT3 dir;				// directional: toward the light, spot: cone axis
+	XMFLOAT3 pos;				// point, spot
+	XMFLOAT3 color;				// point, spot
+	float range;				// point, spot: no light beyond
+	float spotCos;				// spot: cosine of the cone half angle
 	float ambient;
+	float shadowBias;			// depth offset of the shadow map test
 
 public:
 	cpu_light();
@@ -8,8 +8,20 @@ cpu_material::cpu_material()
 	lighting = CPU_LIGHTING_LAMBERT;
 #endif
 
+	shadingRate = CPU_SHADING_RATE_1X1;
+	blend = CPU_BLEND_OPAQUE;
+	alpha = 1.0f;
 	ps = nullptr;
 	color = CPU_WHITE;
 	pTexture = nullptr;
 	values = nullptr;
 }
+
+bool cpu_material::operator==(const cpu_material& other) const
+{
+	if ( lighting!=other.lighting || shadingRate!=other.shadingRate || blend!=other.blend || alpha!=other.alpha )
+		return false;
+	if ( ps!=other.ps || pTexture!=other.pTexture || values!=other.values )
+		return false;
+	return color.x==other.color.x && color.y==other.color.y && color.z==other.color.z;
+}
@@ -4,6 +4,9 @@ struct cpu_material
 {
 public:
 	byte lighting;
+	byte shadingRate;
+	byte blend;
+	float alpha;				// blend factor, the pixel shader can change it (io.alpha)
 	CPU_PS_FUNC ps;
 	XMFLOAT3 color;
 	cpu_texture* pTexture;
@@ -11,4 +14,6 @@ public:
 
 public:
 	cpu_material();
+
+	bool operator==(const cpu_material& other) const;
 };
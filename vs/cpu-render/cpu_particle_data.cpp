@@ -21,6 +21,9 @@ void cpu_particle_data::Reset()
 	alive = 0;
 	blob = nullptr;
 	size = 0;
+	simulation[0] = nullptr;
+	simulation[1] = nullptr;
+	current = 0;
 	px = nullptr;
 	py = nullptr;
 	pz = nullptr;
@@ -34,11 +37,13 @@ void cpu_particle_data::Reset()
 	g = nullptr;
 	b = nullptr;
 	blend = nullptr;
+	radius = nullptr;
 	tile = nullptr;
 	sort = nullptr;
 	sx = nullptr;
 	sy = nullptr;
 	sz = nullptr;
+	sr = nullptr;
 }
 
 void cpu_particle_data::Create(int maxP)
@@ -49,19 +54,40 @@ void cpu_particle_data::Create(int maxP)
 	int count8 = maxCount;
 	int count16 = maxCount * 2;
 	int count32 = maxCount * 4;
-	size	= 3 * count32		// px py pz
-			+ 3 * count32		// vx vy vz
-			+ 3 * count32		// age duration invDuration
-			+ 3 * count32		// r g b
-			+ 1 * count8		// blend
+	int sizeSimulation	= 3 * count32		// px py pz
+						+ 3 * count32		// vx vy vz
+						+ 3 * count32		// age duration invDuration
+						+ 3 * count32		// r g b
+						+ 1 * count32		// radius
+						+ 1 * count8;		// blend
+	sizeSimulation = (sizeSimulation + 63) & ~63;
+	size	= 2 * sizeSimulation	// double buffer
 			+ 1 * count8		// tile
 			+ 1 * count32		// sort
 			+ 2 * count16		// sx sy
-			+ 1 * count32;		// sz
+			+ 2 * count32;		// sz sr
 
-	blob = _aligned_malloc(size, 32); // SIMD: 32 or 64
+	blob = _aligned_malloc(size, 64); // SIMD: 32 or 64
 	byte* ptr = (byte*)blob;
 
+	simulation[0] = ptr; ptr += sizeSimulation;
+	simulation[1] = ptr; ptr += sizeSimulation;
+	current = 0;
+	Bind(simulation[0]);
+
+	tile = (byte*)ptr; ptr += count8;
+	sort = (ui32*)ptr; ptr += count32;
+	sx = (ui16*)ptr; ptr += count16;
+	sy = (ui16*)ptr; ptr += count16;
+	sz = (float*)ptr; ptr += count32;
+	sr = (float*)ptr; ptr += count32;
+}
+
+void cpu_particle_data::Bind(byte* ptr)
+{
+	int count8 = maxCount;
+	int count32 = maxCount * 4;
+
 	px = (float*)ptr; ptr += count32;
 	py = (float*)ptr; ptr += count32;
 	pz = (float*)ptr; ptr += count32;
@@ -77,13 +103,8 @@ void cpu_particle_data::Create(int maxP)
 	r = (float*)ptr; ptr += count32;
 	g = (float*)ptr; ptr += count32;
 	b = (float*)ptr; ptr += count32;
+	radius = (float*)ptr; ptr += count32;
 	blend = (byte*)ptr; ptr += count8;
-
-	tile = (byte*)ptr; ptr += count8;
-	sort = (ui32*)ptr; ptr += count32;
-	sx = (ui16*)ptr; ptr += count16;
-	sy = (ui16*)ptr; ptr += count16;
-	sz = (float*)ptr; ptr += count32;
 }
 
 void cpu_particle_data::Destroy()
@@ -93,47 +114,70 @@ void cpu_particle_data::Destroy()
 	Reset();
 }
 
-void cpu_particle_data::UpdateAge()
+int cpu_particle_data::UpdateAge(int min, int max)
 {
-	if ( alive<=0 )
-		return;
-
+	// Survivors of the range (compacted by Scatter, order kept)
 	const float dt = cpuTime.delta;
-	int i = 0;
-	while ( i<alive )
+	int count = 0;
+	for ( int i=min ; i<max ; i++ )
 	{
 		age[i] += dt;
+		count += age[i]<duration[i] ? 1 : 0;
+	}
+	return count;
+}
+
+void cpu_particle_data::Scatter(int min, int max, int offset)
+{
+	// Same layout in the other half
+	const ptrdiff_t delta = simulation[current^1] - simulation[current];
+	float* dpx = (float*)((byte*)px + delta);
+	float* dpy = (float*)((byte*)py + delta);
+	float* dpz = (float*)((byte*)pz + delta);
+	float* dvx = (float*)((byte*)vx + delta);
+	float* dvy = (float*)((byte*)vy + delta);
+	float* dvz = (float*)((byte*)vz + delta);
+	float* dage = (float*)((byte*)age + delta);
+	float* dduration = (float*)((byte*)duration + delta);
+	float* dinvDuration = (float*)((byte*)invDuration + delta);
+	float* dr = (float*)((byte*)r + delta);
+	float* dg = (float*)((byte*)g + delta);
+	float* db = (float*)((byte*)b + delta);
+	float* dradius = (float*)((byte*)radius + delta);
+	byte* dblend = blend + delta;
+
+	int j = offset;
+	for ( int i=min ; i<max ; i++ )
+	{
 		if ( age[i]>=duration[i] )
-		{
-			const int last = alive - 1;
-			if ( i<last )
-			{
-				px[i] = px[last];
-				py[i] = py[last];
-				pz[i] = pz[last];
-				vx[i] = vx[last];
-				vy[i] = vy[last];
-				vz[i] = vz[last];
-				age[i] = age[last];
-				duration[i] = duration[last];
-				invDuration[i] = invDuration[last];
-				r[i] = r[last];
-				g[i] = g[last];
-				b[i] = b[last];
-				blend[i] = blend[last];
-				tile[i] = tile[last];
-				sort[i] = sort[last];
-				sx[i] = sx[last];
-				sy[i] = sy[last];
-				sz[i] = sz[last];
-			}
-			--alive;
 			continue;
-		}
-		++i;
+
+		dpx[j] = px[i];
+		dpy[j] = py[i];
+		dpz[j] = pz[i];
+		dvx[j] = vx[i];
+		dvy[j] = vy[i];
+		dvz[j] = vz[i];
+		dage[j] = age[i];
+		dduration[j] = duration[i];
+		dinvDuration[j] = invDuration[i];
+		dr[j] = r[i];
+		dg[j] = g[i];
+		db[j] = b[i];
+		dradius[j] = radius[i];
+		dblend[j] = blend[i];
+		j++;
 	}
 }
 
+void cpu_particle_data::Swap(int count)
+{
+	// Render arrays (tile, sort, sx...) are rebuilt from the new order
+	current ^= 1;
+	Bind(simulation[current]);
+	alive = count;
+}
+
 void cpu_particle_data::UpdatePhysics(int min, int max)
 {
 	const float dt = cpuTime.delta;
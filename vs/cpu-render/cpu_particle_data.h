@@ -13,6 +13,10 @@ public:
 	void* blob;
 	int size;
 
+	// Double buffer: the compaction scatters the survivors into the other simulation half (same layout)
+	byte* simulation[2];
+	int current;
+
 	float* px;
 	float* py;
 	float* pz;
@@ -29,6 +33,7 @@ public:
 	float* g;
 	float* b;
 	byte* blend;
+	float* radius;		// radius: world units, negative for pixels, 0 for one pixel
 
 	// Render
 	byte* tile;
@@ -36,6 +41,7 @@ public:
 	ui16* sx;
 	ui16* sy;
 	float* sz;
+	float* sr;			// radius in pixels (< 0.5: one pixel)
 
 public:
 	cpu_particle_data();
@@ -45,7 +51,12 @@ public:
 
 	void Create(int maxP);
 	void Destroy();
-	void UpdateAge();
+	int UpdateAge(int min, int max);
+	void Scatter(int min, int max, int offset);
+	void Swap(int count);
 	void UpdatePhysics(int min, int max);
 	inline void ApplyBounds(float& px, float& py, float& pz, float& vx, float& vy, float& vz);
+
+private:
+	void Bind(byte* ptr);
 };
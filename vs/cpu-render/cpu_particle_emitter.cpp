@@ -21,6 +21,8 @@ cpu_particle_emitter::cpu_particle_emitter()
 	durationMax = 3.0f;
 	speedMin = 0.7f;
 	speedMax = 1.3f;
+	sizeMin = 0.0f;
+	sizeMax = 0.0f;
 	spread = 0.5f;
 
 	accum = 0.0f;
@@ -71,5 +73,6 @@ void cpu_particle_emitter::Update(int pixelCount)
 		p.b[i] = std::lerp(colorMin.z, colorMax.z, rndRatio) * rndIntensity;
 
 		p.blend[i] = blend;
+		p.radius[i] = std::lerp(sizeMin, sizeMax, cpu::Rand01(seed));
 	}
 }
@@ -18,6 +18,8 @@ public:
 	float durationMax;		// duration range
 	float speedMin;			// speed range
 	float speedMax;			// speed range
+	float sizeMin;			// radius range: world units, negative for pixels, 0 for one pixel
+	float sizeMax;			// radius range
 	float spread;			// dispersion directionnelles
 							// 0		=> jet laser, pluie parfaitement verticale, rayon
 							// 0.05-0.2 => fume canalise, vapeur, souffle
@@ -10,5 +10,6 @@ public:
 
 	// Output
 	XMFLOAT3 color;
+	float alpha;
 	bool discard;
 };
@@ -13,10 +13,10 @@ cpu_rt::cpu_rt()
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
 
-void cpu_rt::Create(int width, int height, bool useDepth)
+void cpu_rt::Create(int width, int height, bool useDepth, int format)
 {
-	width = width;
-	height = height;
+	this->width = width;
+	this->height = height;
 	aspectRatio = float(width) / float(height);
 	pixelCount = width * height;
 	stride = width * 4;
@@ -24,10 +24,22 @@ void cpu_rt::Create(int width, int height, bool useDepth)
 	heightHalf = height * 0.5f;
 	colorBuffer.resize(pixelCount);
 	depth = useDepth;
-	if ( depth )
+	depthFormat = format;
+	if ( depth && depthFormat==CPU_DEPTH_FORMAT_U16 )
+	{
+		depthBuffer.clear();
+		depthBuffer16.resize(pixelCount);
+	}
+	else if ( depth )
+	{
 		depthBuffer.resize(pixelCount);
+		depthBuffer16.clear();
+	}
 	else
+	{
 		depthBuffer.clear();
+		depthBuffer16.clear();
+	}
 }
 
 void cpu_rt::Destroy()
@@ -39,6 +51,38 @@ void cpu_rt::Destroy()
 	widthHalf = 0;
 	heightHalf = 0;
 	depth = false;
+	depthFormat = CPU_DEPTH_FORMAT_F32;
 	colorBuffer.clear();
 	depthBuffer.clear();
+	depthBuffer16.clear();
+}
+
+float cpu_rt::GetDepth(int index)
+{
+	// Normalized: 0 near, 1 far (a reversed depth is 1 minus the standard one)
+	switch ( depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		return cpu_depth_u16::Decode(depthBuffer16[index]);
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		return 1.0f - depthBuffer[index];
+	default:
+		return depthBuffer[index];
+	}
+}
+
+void cpu_rt::SetDepth(int index, float z)
+{
+	switch ( depthFormat )
+	{
+	case CPU_DEPTH_FORMAT_U16:
+		depthBuffer16[index] = cpu_depth_u16::Encode(cpu::Clamp(z));
+		break;
+	case CPU_DEPTH_FORMAT_F32_REVERSED:
+		depthBuffer[index] = 1.0f - z;
+		break;
+	default:
+		depthBuffer[index] = z;
+		break;
+	}
 }
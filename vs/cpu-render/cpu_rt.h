@@ -12,11 +12,16 @@ public:
 	float heightHalf;
 	std::vector<ui32> colorBuffer;
 	bool depth;
-	std::vector<float> depthBuffer;
+	byte depthFormat;
+	std::vector<float> depthBuffer;			// F32, F32_REVERSED
+	std::vector<ui16> depthBuffer16;		// U16
 
 public:
 	cpu_rt();
 
-	void Create(int width, int height, bool useDepth = true);
+	void Create(int width, int height, bool useDepth = true, int format = CPU_DEPTH_FORMAT_F32);
 	void Destroy();
+
+	float GetDepth(int index);
+	void SetDepth(int index, float z);
 };
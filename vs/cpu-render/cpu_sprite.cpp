@@ -12,6 +12,7 @@ cpu_sprite::cpu_sprite()
 	sortedIndex = -1;
 	dead = false;
 	visible = true;
+	pLastTexture = nullptr;
 }
 
 ////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////////
@@ -26,3 +27,17 @@ void cpu_sprite::CenterAnchor()
 		anchorY = pTexture->height/2;
 	}
 }
+
+void cpu_sprite::GetBox(cpu_rectangle& box)
+{
+	if ( dead || visible==false || pTexture==nullptr )
+	{
+		box.Zero();
+		return;
+	}
+
+	box.minX = x - anchorX;
+	box.minY = y - anchorY;
+	box.maxX = box.minX + pTexture->width;
+	box.maxY = box.minY + pTexture->height;
+}
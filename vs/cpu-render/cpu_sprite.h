@@ -11,8 +11,13 @@ public:
 	int anchorY;
 	bool visible;
 
+	// Incremental
+	cpu_rectangle lastBox;
+	cpu_texture* pLastTexture;
+
 public:
 	cpu_sprite();
 
 	void CenterAnchor();
+	void GetBox(cpu_rectangle& box);
 };
@@ -5,10 +5,15 @@ void cpu_tile::Reset()
 	// Entity
 	statsDrawnTriangleCount = 0;
 
+	// Light
+	minZ = FLT_MAX;
+	maxZ = -FLT_MAX;
+	lights.clear();
+
 	// Particle
 	for ( size_t i=0 ; i<particleLocalCounts.size() ; i++ )
 		particleLocalCounts[i] = 0;
 	particleCount = 0;
 	particleOffset = 0;
-	particleOffsetTemp = 0;
+	particleSplatCount = 0;
 }
@@ -10,14 +10,25 @@ public:
 	int row;
 	int col;
 
+	// Incremental
+	bool dirty;
+
 	// Entity
 	int statsDrawnTriangleCount;
+	byte shadingRate;
+
+	// Light: view depth range of the entities, point and spot lights touching it
+	float minZ;
+	float maxZ;
+	std::vector<cpu_light*> lights;
 
 	// Particle
 	std::vector<int> particleLocalCounts;
+	std::vector<int> particleLocalOffsets;	// write position of this tile's range in each destination tile
 	int particleCount;
 	int particleOffset;
-	int particleOffsetTemp;
+	int particleLastCount;
+	int particleSplatCount;			// sized particles assigned by this tile job (drawn over the neighbor tiles too)
 
 public:
 	void Reset();
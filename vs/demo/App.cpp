@@ -54,6 +54,16 @@ void App::OnStart()
 
 	// Render
 	//cpuEngine.EnableBoxRender();
+	//cpuEngine.EnableCheckerboardRender();
+	//cpuEngine.EnableDynamicResolution();
+	//cpuEngine.EnableAutoShadingRate();
+	//cpuEngine.SetDepthFormat(CPU_DEPTH_FORMAT_F32_REVERSED);
+	//cpuEngine.GetDevice()->AddBlur(2);
+	//cpuEngine.EnableDepthPrepass();
+	//cpuEngine.EnableShadow();
+	//cpuEngine.EnablePipeline();
+	//cpuEngine.SetThreadPlacement(CPU_PLACEMENT_PIN | CPU_PLACEMENT_SKIP_SMT);
+	//cpuEngine.StartSweep();
 
 	// Resources
 	m_font.Create(cpuDevice.GetHeight()<=512 ? 14 : 28);
@@ -218,7 +228,7 @@ void App::OnRender(int pass)
 			info += CPU_STR(stats.clipEntityCount) + " clipped entities\n";
 			info += CPU_STR(m_missiles.size()) + " missiles, ";
 			info += CPU_STR(cpuEngine.GetParticleData()->alive) + " particles, ";
-			info += CPU_STR(stats.threadCount) + " threads, ";
+			info += CPU_STR(stats.threadCount) + " threads (" + CPU_STR(stats.coreCount) + " cores), ";
 			info += CPU_STR(stats.tileCount) + " tiles";
 
 			// Ray cast